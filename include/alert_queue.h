@@ -0,0 +1,204 @@
+/*
+  alert_queue.h
+
+  Description:
+  ------------
+  * Sequencing for sound and vibration alerts, so they play without blocking loop()
+  * An alert is a fixed list of steps (tone, PCM clip, vibration, pause). The queue only
+    says which step to start and when, main.cpp hands it to the speaker DMA or the motor
+  * Higher priority alerts cut in on lower ones, equal or lower priority alerts wait
+    their turn. Feedback alerts are dropped rather than queued - a late click is worse
+    than none
+*/
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#define alert_queue_len 4
+#define alert_pcm_rate  8000  // Sample rate of the precomputed clips
+#define alert_chime_ms  400
+#define alert_chime_len (alert_pcm_rate * alert_chime_ms / 1000)
+#define alert_final_sec 10  // Final alert this many seconds before switching off, see alert_final_at()
+
+enum alert_step_kind : uint8_t {
+  ALERT_STEP_END = 0,  // Terminates the step list
+  ALERT_STEP_TONE,     // arg = frequency Hz
+  ALERT_STEP_PCM,      // arg = clip index
+  ALERT_STEP_VIBRATE,  // arg = motor level 0-255
+  ALERT_STEP_PAUSE,
+};
+
+struct alert_step {
+  alert_step_kind kind;
+  uint16_t arg;
+  uint16_t duration_ms;
+};
+
+enum alert_priority : uint8_t {
+  ALERT_PRIO_FEEDBACK = 0,  // Button clicks, dropped if anything else is playing
+  ALERT_PRIO_INFO,          // e.g. profile changed
+  ALERT_PRIO_WARNING,       // About to switch off
+  ALERT_PRIO_CRITICAL,      // Final seconds
+};
+
+struct alert_def {
+  const char* name;
+  alert_priority prio;
+  const alert_step* steps;  // Ends with ALERT_STEP_END
+};
+
+struct alert_queue {
+  const alert_def* pending[alert_queue_len];  // Highest priority first
+  uint8_t count;
+  const alert_def* current;
+  uint8_t step;
+  uint32_t step_end_ms;
+};
+
+enum alert_action : uint8_t {
+  ALERT_ACT_NONE = 0,  // Nothing to do
+  ALERT_ACT_STEP,      // Start the returned step now
+  ALERT_ACT_IDLE,      // Last alert finished, silence the speaker and motor
+};
+
+/*
+  alert_push()
+
+  Description:
+  ------------
+  * Queue an alert. An alert already playing or queued is not added twice
+
+  Return:
+  -------
+  * true if the alert cut in on the one playing, the caller should stop the
+    speaker and motor straight away
+*/
+static inline bool alert_push(alert_queue& q, const alert_def* def) {
+  if (q.current == def)
+    return false;
+  for (uint8_t i = 0; i < q.count; i++)
+    if (q.pending[i] == def) return false;
+
+  if (q.current && def->prio == ALERT_PRIO_FEEDBACK)
+    return false;
+
+  if (q.current && def->prio > q.current->prio) {
+    q.current = nullptr;  // Dropped, not resumed - a half played chime is meaningless
+    if (q.count == alert_queue_len)
+      q.count--;
+    for (uint8_t i = q.count; i > 0; i--)
+      q.pending[i] = q.pending[i - 1];
+    q.pending[0] = def;
+    q.count++;
+    return true;
+  }
+
+  // Insert behind alerts of the same or higher priority, dropping the lowest if full
+  uint8_t pos = 0;
+  while (pos < q.count && q.pending[pos]->prio >= def->prio)
+    pos++;
+  if (pos >= alert_queue_len)
+    return false;
+  if (q.count == alert_queue_len)
+    q.count--;
+  for (uint8_t i = q.count; i > pos; i--)
+    q.pending[i] = q.pending[i - 1];
+  q.pending[pos] = def;
+  q.count++;
+  return false;
+}
+
+/*
+  alert_service()
+
+  Description:
+  ------------
+  * Advance the queue, call from loop()
+
+  Inputs:
+  -------
+  * now_ms   - current time
+  * step     - set to the step to start when ALERT_ACT_STEP is returned
+  * finished - set to the alert that just completed, nullptr otherwise
+
+  Return:
+  -------
+  * What the caller should do, see alert_action
+*/
+static inline alert_action alert_service(alert_queue& q, uint32_t now_ms, alert_step& step, const alert_def*& finished) {
+  finished = nullptr;
+
+  if (q.current) {
+    if ((int32_t)(now_ms - q.step_end_ms) < 0)
+      return ALERT_ACT_NONE;
+    q.step++;
+    if (q.current->steps[q.step].kind == ALERT_STEP_END) {
+      finished = q.current;
+      q.current = nullptr;
+    }
+  }
+
+  if (!q.current) {
+    if (q.count == 0)
+      return finished ? ALERT_ACT_IDLE : ALERT_ACT_NONE;
+    q.current = q.pending[0];
+    q.count--;
+    for (uint8_t i = 0; i < q.count; i++)
+      q.pending[i] = q.pending[i + 1];
+    q.step = 0;
+  }
+
+  step = q.current->steps[q.step];
+  q.step_end_ms = now_ms + step.duration_ms;
+  return ALERT_ACT_STEP;
+}
+
+/*
+  alert_final_at()
+
+  Description:
+  ------------
+  * Seconds left on the timer when the final alert plays. alert_final_sec, except that
+    a profile with a short warning gets it half way through the warning, so it never
+    plays before the warning or on top of it
+
+  Inputs:
+  -------
+  * warning_sec - warning time of the active profile
+
+  Return:
+  -------
+  * Seconds left, 0 for no final alert (a warning under 2 seconds)
+*/
+static inline uint16_t alert_final_at(uint16_t warning_sec) {
+  uint16_t half = warning_sec / 2;
+  return (half < alert_final_sec) ? half : alert_final_sec;
+}
+
+/*
+  alert_pcm_chime()
+
+  Description:
+  ------------
+  * Fill buf with a two note chime, each note a decaying sine with a 3rd harmonic
+  * Run once at start up so playing it is only a DMA transfer
+
+  Inputs:
+  -------
+  * len        - number of 8-bit samples at alert_pcm_rate
+  * f1, f2     - frequency of the first and second note, Hz
+*/
+static inline void alert_pcm_chime(int8_t* buf, uint32_t len, float f1, float f2) {
+  const float two_pi = 6.2831853f;
+  uint32_t half = len / 2;
+
+  for (uint32_t i = 0; i < len; i++) {
+    uint32_t n = (i < half) ? i : i - half;
+    float t = (float)n / alert_pcm_rate;
+    float f = (i < half) ? f1 : f2;
+    float env = expf(-t * 12.0f);
+    float s = sinf(two_pi * f * t) + 0.3f * sinf(two_pi * 3 * f * t);
+    buf[i] = (int8_t)(s * env * 90.0f);  // Peak 1.3 * 90 stays inside int8
+  }
+}
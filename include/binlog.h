@@ -0,0 +1,232 @@
+/*
+  binlog.h
+
+  Description:
+  ------------
+  * Deferred format logger. A log call only stores the format string pointer, the raw
+    arguments and a time stamp in a ring buffer; the text is formatted later by a low
+    priority task, so logging costs loop() a few microseconds instead of a printf and
+    a wait on the UART
+  * Levels as CORE_DEBUG_LEVEL (1 error ... 5 verbose), but set on their own with
+    BINLOG_LEVEL, info by default, so the framework can stay quiet without losing the
+    app's own figures. Calls above it compile to nothing, but the arguments are still
+    type checked so they don't rot
+  * The format must be a string literal. Up to binlog_max_args integer, float or string
+    arguments; strings are copied into the record so stack buffers are safe to log
+  * Lock free for one writer (the loop task) and one reader (the drain task)
+  * The caller provides binlog_main and binlog_now_ms()
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <type_traits>
+
+#define binlog_ring_len  64  // Records, must be a power of 2
+#define binlog_max_args  6
+#define binlog_text_len  48  // Space for copies of string arguments, per record
+
+#define binlog_level_error   1
+#define binlog_level_warn    2
+#define binlog_level_info    3
+#define binlog_level_debug   4
+#define binlog_level_verbose 5
+
+#ifndef BINLOG_LEVEL
+  #define BINLOG_LEVEL binlog_level_info
+#endif
+
+struct binlog_rec {
+  const char* fmt;  // Doubles as the message ID
+  uint32_t ms;
+  uint8_t level;
+  uint8_t nargs;
+  uint8_t text_used;
+  uintptr_t args[binlog_max_args];  // Integers, float bits, or offsets into text
+  char text[binlog_text_len];
+};
+
+struct binlog_ring {
+  binlog_rec recs[binlog_ring_len];
+  std::atomic<uint32_t> head;     // Written by the logging task only
+  std::atomic<uint32_t> tail;     // Written by the drain task only
+  std::atomic<uint32_t> dropped;  // Records lost because the ring was full
+};
+
+extern binlog_ring binlog_main;
+uint32_t binlog_now_ms();
+
+#define blog_at(level, fmt, ...)                                                    \
+  do {                                                                              \
+    if ((level) <= BINLOG_LEVEL)                                                    \
+      binlog_write(binlog_main, binlog_now_ms(), (level), (fmt), ##__VA_ARGS__);    \
+  } while (0)
+
+#define blog_e(fmt, ...) blog_at(binlog_level_error, fmt, ##__VA_ARGS__)
+#define blog_w(fmt, ...) blog_at(binlog_level_warn, fmt, ##__VA_ARGS__)
+#define blog_i(fmt, ...) blog_at(binlog_level_info, fmt, ##__VA_ARGS__)
+#define blog_d(fmt, ...) blog_at(binlog_level_debug, fmt, ##__VA_ARGS__)
+#define blog_v(fmt, ...) blog_at(binlog_level_verbose, fmt, ##__VA_ARGS__)
+
+// Argument capture, one overload per kind of argument
+template <typename T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, int>::type = 0>
+static inline void binlog_put(binlog_rec& r, T v) {
+  if (r.nargs < binlog_max_args) r.args[r.nargs++] = (uintptr_t)v;
+}
+
+static inline void binlog_put(binlog_rec& r, double v) {
+  float f = (float)v;
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  if (r.nargs < binlog_max_args) r.args[r.nargs++] = bits;
+}
+
+static inline void binlog_put(binlog_rec& r, const char* s) {
+  uint8_t off = (r.text_used < binlog_text_len) ? r.text_used : binlog_text_len - 1;
+  size_t n = s ? strnlen(s, binlog_text_len - 1 - off) : 0;
+
+  memcpy(r.text + off, s, n);
+  r.text[off + n] = '\0';
+  r.text_used = off + n + 1;
+  if (r.nargs < binlog_max_args) r.args[r.nargs++] = off;
+}
+
+static inline void binlog_pack(binlog_rec&) {
+}
+
+template <typename T, typename... Rest>
+static inline void binlog_pack(binlog_rec& r, T v, Rest... rest) {
+  binlog_put(r, v);
+  binlog_pack(r, rest...);
+}
+
+/*
+  binlog_write()
+
+  Description:
+  ------------
+  * Store one record, use the blog_x() macros rather than calling this directly
+
+  Return:
+  -------
+  * false if the ring was full and the record was dropped
+*/
+template <typename... Args>
+static inline bool binlog_write(binlog_ring& ring, uint32_t now_ms, uint8_t level, const char* fmt, Args... args) {
+  uint32_t head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= binlog_ring_len) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  binlog_rec& r = ring.recs[head & (binlog_ring_len - 1)];
+  r.fmt = fmt;
+  r.ms = now_ms;
+  r.level = level;
+  r.nargs = 0;
+  r.text_used = 0;
+  binlog_pack(r, args...);
+
+  ring.head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+// Take the oldest record, returns false if the ring is empty
+static inline bool binlog_read(binlog_ring& ring, binlog_rec& rec) {
+  uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+  if (tail == ring.head.load(std::memory_order_acquire))
+    return false;
+
+  rec = ring.recs[tail & (binlog_ring_len - 1)];
+  ring.tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+static inline bool binlog_empty(const binlog_ring& ring) {
+  return ring.tail.load(std::memory_order_acquire) == ring.head.load(std::memory_order_acquire);
+}
+
+/*
+  binlog_format()
+
+  Description:
+  ------------
+  * Turn a record into text, in the same layout as the ESP32 log_x() macros
+  * Length modifiers (l, h, z...) are ignored, every argument was stored as 32 bits
+
+  Return:
+  -------
+  * Length of the text in out
+*/
+static inline size_t binlog_format(const binlog_rec& rec, char* out, size_t len) {
+  static const char level_chars[] = "NEWIDV";
+  int w = snprintf(out, len, "[%6u][%c] ", (unsigned)rec.ms, level_chars[rec.level <= binlog_level_verbose ? rec.level : 0]);
+  size_t n = (w > 0 && (size_t)w < len) ? w : 0;
+  const char* f = rec.fmt;
+  uint8_t arg = 0;
+
+  while (*f && n < len - 1) {
+    if (*f != '%') {
+      out[n++] = *f++;
+      continue;
+    }
+    if (f[1] == '%') {
+      out[n++] = '%';
+      f += 2;
+      continue;
+    }
+
+    // Copy the flags, width and precision, drop the length modifier
+    char spec[16];
+    uint8_t s = 0;
+    spec[s++] = *f++;
+    while (*f && strchr("-+ #0123456789.", *f) && s < sizeof(spec) - 2)
+      spec[s++] = *f++;
+    while (*f && strchr("hlLqjzt", *f))
+      f++;
+    char conv = *f ? *f++ : 's';
+    spec[s++] = conv;
+    spec[s] = '\0';
+
+    uintptr_t a = (arg < rec.nargs) ? rec.args[arg++] : 0;
+    float fv;
+    uint32_t bits = (uint32_t)a;
+    switch (conv) {
+      case 'd':
+      case 'i':
+      case 'c':
+        w = snprintf(out + n, len - n, spec, (int)(int32_t)a);
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        w = snprintf(out + n, len - n, spec, (unsigned)bits);
+        break;
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+        memcpy(&fv, &bits, sizeof(fv));
+        w = snprintf(out + n, len - n, spec, (double)fv);
+        break;
+      case 's':
+        w = snprintf(out + n, len - n, spec, (a < binlog_text_len) ? rec.text + a : "");
+        break;
+      case 'p':
+        w = snprintf(out + n, len - n, spec, (void*)a);
+        break;
+      default:
+        w = 0;
+        break;
+    }
+    if (w > 0) n += ((size_t)w < len - n) ? (size_t)w : len - 1 - n;
+  }
+  out[n] = '\0';
+  return n;
+}
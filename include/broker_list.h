@@ -0,0 +1,122 @@
+/*
+  broker_list.h
+
+  Description:
+  ------------
+  * Ordered list of MQTT brokers with a health score for each
+  * The broker to try next is the healthiest one that is not backing off. Health is the
+    smoothed connect time plus a penalty per recent failure, and the last broker that
+    worked gets a bonus so the client sticks with it rather than flapping
+  * Failed brokers back off exponentially, 1s, 2s, 4s... up to broker_max_backoff_ms
+  * The caller does the connecting and reports the result
+*/
+#pragma once
+
+#include <stdint.h>
+
+#define broker_fail_penalty_ms 2000   // Each consecutive failure counts as this much extra connect time
+#define broker_sticky_bonus_ms 500    // Preference for the last broker that connected
+#define broker_order_ms        50     // Small preference for brokers earlier in the list
+#define broker_max_backoff_ms  30000
+#define broker_no_pick         0xFF
+
+struct mqtt_broker {
+  uint32_t ip;  // IPv4 address, as IPAddress casts to uint32_t
+  uint16_t port;
+  uint16_t connect_ms;  // Smoothed connect time, 0 = never connected
+  uint8_t failures;     // Consecutive failures
+  uint32_t retry_at_ms;  // Don't try again before this time
+};
+
+struct broker_list {
+  mqtt_broker* brokers;
+  uint8_t count;
+  uint8_t last_good;  // Index of the last broker that connected, broker_no_pick if none
+};
+
+/*
+  broker_score()
+
+  Description:
+  ------------
+  * Health score of one broker, lower is better
+*/
+static inline uint32_t broker_score(const broker_list& list, uint8_t idx) {
+  const mqtt_broker& b = list.brokers[idx];
+  uint32_t score = b.connect_ms + (uint32_t)b.failures * broker_fail_penalty_ms + (uint32_t)idx * broker_order_ms;
+
+  if (idx == list.last_good)
+    score = (score > broker_sticky_bonus_ms) ? score - broker_sticky_bonus_ms : 0;
+  return score;
+}
+
+/*
+  broker_pick_except()
+
+  Description:
+  ------------
+  * Choose the broker to try next
+
+  Inputs:
+  -------
+  * now_ms - current time, millis()
+  * skip   - bit n set = leave out broker n, e.g. one already being tried
+
+  Return:
+  -------
+  * Broker index, or broker_no_pick if every broker is backing off or skipped
+*/
+static inline uint8_t broker_pick_except(const broker_list& list, uint32_t now_ms, uint32_t skip) {
+  uint8_t best = broker_no_pick;
+  uint32_t best_score = UINT32_MAX;
+
+  for (uint8_t i = 0; i < list.count; i++) {
+    if (skip & (1UL << i))
+      continue;
+    if ((int32_t)(now_ms - list.brokers[i].retry_at_ms) < 0)
+      continue;  // Still backing off
+    uint32_t score = broker_score(list, i);
+    if (score < best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+  return best;
+}
+
+static inline uint8_t broker_pick(const broker_list& list, uint32_t now_ms) {
+  return broker_pick_except(list, now_ms, 0);
+}
+
+/*
+  broker_report()
+
+  Description:
+  ------------
+  * Record the result of a connection attempt
+
+  Inputs:
+  -------
+  * idx        - broker that was tried
+  * ok         - true if the connection succeeded
+  * elapsed_ms - how long the attempt took
+  * now_ms     - current time, millis()
+*/
+static inline void broker_report(broker_list& list, uint8_t idx, bool ok, uint32_t elapsed_ms, uint32_t now_ms) {
+  mqtt_broker& b = list.brokers[idx];
+
+  if (elapsed_ms > UINT16_MAX) elapsed_ms = UINT16_MAX;
+
+  if (ok) {
+    // Exponentially weighted average, 1/4 new sample
+    b.connect_ms = (b.connect_ms == 0) ? elapsed_ms : (uint16_t)((3UL * b.connect_ms + elapsed_ms) / 4);
+    b.failures = 0;
+    b.retry_at_ms = now_ms;
+    list.last_good = idx;
+  } else {
+    if (b.failures < 15) b.failures++;
+    uint32_t backoff = 1000UL << (b.failures - 1);
+    if (backoff > broker_max_backoff_ms) backoff = broker_max_backoff_ms;
+    b.retry_at_ms = now_ms + backoff;
+  }
+}
@@ -0,0 +1,208 @@
+/*
+  broker_race.h
+
+  Description:
+  ------------
+  * Non-blocking TCP connect to the MQTT brokers in broker_list.h, polled from loop()
+  * The healthiest broker is tried first. If it hasn't answered after
+    broker_race_stagger_ms, or fails, the next healthiest is tried alongside it and
+    whichever connects first wins. The others are closed
+  * Each attempt is limited to a timeout, a broker that fails or times out is reported
+    to broker_list so it backs off
+  * A TCP connect only shows the broker's host is up. The winner is kept in the race and
+    the caller reports it with broker_race_done() once the broker has answered the MQTT
+    CONNECT, so a broker that refuses MQTT backs off like one that is down
+  * Plain BSD sockets: lwIP on the Core2, the host's own sockets in the tests
+*/
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ARDUINO
+  #include <lwip/sockets.h>
+#else
+  #include <netinet/in.h>
+  #include <sys/select.h>
+  #include <sys/socket.h>
+  #include <unistd.h>
+#endif
+
+#include "broker_list.h"
+
+#define broker_race_len        2    // Connections in flight at once
+#define broker_race_stagger_ms 250  // Head start for the healthiest broker
+
+struct broker_attempt {
+  int fd;  // -1 = slot free
+  uint8_t idx;
+  uint32_t start_ms;
+};
+
+struct broker_race {
+  broker_attempt attempts[broker_race_len];
+  uint32_t last_start_ms;
+  uint8_t winner;            // Broker handed over by the last RACE_CONNECTED, broker_no_pick once reported
+  uint32_t winner_start_ms;  // When its TCP connect started
+};
+
+enum broker_race_result : uint8_t {
+  RACE_IDLE = 0,   // Nothing in flight, every broker is backing off
+  RACE_PENDING,    // Still connecting
+  RACE_CONNECTED,  // fd and idx are set, the socket is back in blocking mode
+};
+
+static inline void broker_race_init(broker_race& race) {
+  for (uint8_t i = 0; i < broker_race_len; i++)
+    race.attempts[i].fd = -1;
+  race.last_start_ms = 0;
+  race.winner = broker_no_pick;
+}
+
+static inline void broker_race_close(broker_attempt& a) {
+  if (a.fd >= 0) close(a.fd);
+  a.fd = -1;
+}
+
+// Close everything in flight, e.g. before deep sleep
+static inline void broker_race_abort(broker_race& race) {
+  for (uint8_t i = 0; i < broker_race_len; i++)
+    broker_race_close(race.attempts[i]);
+}
+
+/*
+  broker_race_start()
+
+  Description:
+  ------------
+  * Open a non-blocking socket and start connecting to one broker
+
+  Return:
+  -------
+  * false if the connect failed straight away, the failure has been reported
+*/
+static inline bool broker_race_start(broker_race& race, broker_attempt& a, broker_list& list, uint8_t idx, uint32_t now_ms) {
+  const mqtt_broker& b = list.brokers[idx];
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(b.port);
+  addr.sin_addr.s_addr = b.ip;  // Already in network order
+
+  race.last_start_ms = now_ms;
+  a.idx = idx;
+  a.start_ms = now_ms;
+  a.fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (a.fd >= 0 && fcntl(a.fd, F_SETFL, fcntl(a.fd, F_GETFL, 0) | O_NONBLOCK) == 0)
+    if (connect(a.fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 || errno == EINPROGRESS)
+      return true;
+
+  broker_race_close(a);
+  broker_report(list, idx, false, 0, now_ms);
+  return false;
+}
+
+// 1 connected, 0 still connecting, -1 failed
+static inline int broker_race_check(const broker_attempt& a) {
+  fd_set wr;
+  struct timeval tv = {0, 0};
+  FD_ZERO(&wr);
+  FD_SET(a.fd, &wr);
+  if (select(a.fd + 1, nullptr, &wr, nullptr, &tv) <= 0)
+    return 0;
+
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (getsockopt(a.fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+    return -1;
+  return 1;
+}
+
+/*
+  broker_race_poll()
+
+  Description:
+  ------------
+  * Advance the race, call from loop() while not connected. Never waits
+
+  Inputs:
+  -------
+  * now_ms     - current time, millis()
+  * timeout_ms - time limit for each attempt
+  * fd, idx    - set to the connected socket and its broker on RACE_CONNECTED. The
+                 caller owns the socket from then on, and reports the broker with
+                 broker_race_done() once the MQTT connect has succeeded or failed
+
+  Return:
+  -------
+  * See broker_race_result
+*/
+static inline broker_race_result broker_race_poll(broker_race& race, broker_list& list, uint32_t now_ms, uint32_t timeout_ms, int& fd, uint8_t& idx) {
+  uint32_t in_flight = 0;  // Bit mask of brokers being tried
+
+  for (uint8_t i = 0; i < broker_race_len; i++) {
+    broker_attempt& a = race.attempts[i];
+    if (a.fd < 0) continue;
+
+    int state = broker_race_check(a);
+    uint32_t elapsed = now_ms - a.start_ms;
+    if (state > 0) {
+      fd = a.fd;
+      idx = a.idx;
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+      race.winner = a.idx;
+      race.winner_start_ms = a.start_ms;
+      a.fd = -1;
+      broker_race_abort(race);  // Losers aren't reported, the winner becoming last_good is enough
+      return RACE_CONNECTED;
+    }
+    if (state < 0 || elapsed >= timeout_ms) {
+      broker_race_close(a);
+      broker_report(list, a.idx, false, elapsed, now_ms);
+      continue;
+    }
+    in_flight |= 1UL << a.idx;
+  }
+
+  // Bring in the next broker if nothing is in flight, or the leader has had its head start
+  for (uint8_t i = 0; i < broker_race_len; i++) {
+    broker_attempt& a = race.attempts[i];
+    if (a.fd >= 0) continue;
+    if (in_flight && now_ms - race.last_start_ms < broker_race_stagger_ms) break;
+
+    uint8_t next = broker_pick_except(list, now_ms, in_flight);
+    if (next == broker_no_pick) break;
+    if (broker_race_start(race, a, list, next, now_ms))
+      in_flight |= 1UL << next;
+  }
+
+  return in_flight ? RACE_PENDING : RACE_IDLE;
+}
+
+/*
+  broker_race_done()
+
+  Description:
+  ------------
+  * Report how the MQTT connect went on the socket handed over by broker_race_poll().
+    Only a broker that accepted the CONNECT counts as a success and becomes last_good
+
+  Inputs:
+  -------
+  * ok     - true if the broker sent a CONNACK accepting the connection
+  * now_ms - current time, millis()
+
+  Return:
+  -------
+  * Time from the start of the TCP connect, 0 if there was no winner to report
+*/
+static inline uint32_t broker_race_done(broker_race& race, broker_list& list, bool ok, uint32_t now_ms) {
+  if (race.winner == broker_no_pick) return 0;
+
+  uint32_t elapsed = now_ms - race.winner_start_ms;
+  broker_report(list, race.winner, ok, elapsed, now_ms);
+  race.winner = broker_no_pick;
+  return elapsed;
+}
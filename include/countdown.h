@@ -0,0 +1,118 @@
+/*
+  countdown.h
+
+  Description:
+  ------------
+  * The count down timer step and loop() timing statistics, separated from the hardware
+  * The caller passes in the time, millis() on the Core2
+*/
+#pragma once
+
+#include <stdint.h>
+
+#define countdown_tick_ms 1000
+#define countdown_min_sec 5     // Shortest setting the buttons can make
+#define countdown_max_sec 5999  // Longest, 99:59 is as much as the mm:ss timer text can show
+
+enum countdown_event : uint8_t {
+  COUNTDOWN_IDLE = 0,  // Less than a second since the last tick
+  COUNTDOWN_TICK,      // One second taken off the timer
+  COUNTDOWN_EXPIRED,   // Timer was already at zero, time to switch off
+};
+
+/*
+  countdown_step()
+
+  Description:
+  ------------
+  * Advance the count down. The timer shows 0:00 for one full tick before expiring
+  * Ticks stay on a one second grid, so a late loop() iteration delays that tick but
+    not every tick after it. After a stall of more than a tick the grid restarts
+    rather than ticking several times to catch up
+
+  Inputs:
+  -------
+  * remaining_sec - time left, decremented on each tick
+  * last_tick_ms  - time of the previous tick, updated on each tick
+  * now_ms        - current time
+
+  Return:
+  -------
+  * What happened, see countdown_event
+*/
+static inline countdown_event countdown_step(uint32_t& remaining_sec, uint32_t& last_tick_ms, uint32_t now_ms) {
+  if (now_ms - last_tick_ms <= countdown_tick_ms)
+    return COUNTDOWN_IDLE;
+  last_tick_ms += countdown_tick_ms;
+  if (now_ms - last_tick_ms > countdown_tick_ms)
+    last_tick_ms = now_ms;
+
+  if (remaining_sec > 0) {
+    remaining_sec--;
+    return COUNTDOWN_TICK;
+  }
+  return COUNTDOWN_EXPIRED;
+}
+
+// Button 1 shortens the timer by the profile step, but not below countdown_min_sec
+static inline uint32_t countdown_shorter(uint32_t remaining_sec, uint16_t step_sec) {
+  return (remaining_sec >= (uint32_t)step_sec + countdown_min_sec) ? remaining_sec - step_sec : countdown_min_sec;
+}
+
+// Button 2 and UDP extend lengthen the timer by the profile step, but not past countdown_max_sec
+static inline uint32_t countdown_longer(uint32_t remaining_sec, uint16_t step_sec) {
+  return (remaining_sec + step_sec <= countdown_max_sec) ? remaining_sec + step_sec : countdown_max_sec;
+}
+
+// Touch slider position to timer setting
+static inline uint32_t countdown_from_percent(uint8_t percent, uint32_t duration_sec) {
+  return (percent * duration_sec) / 100;
+}
+
+// The hardware side of switching off, provided by main.cpp or a test
+struct shutdown_steps {
+  bool (*publish_off)();  // Switch the appliance off, false if the message couldn't be sent
+  void (*save_state)();   // Profiles and RTC snapshot
+  void (*display_off)();  // LCD and LEDs
+  void (*sleep)();        // Deep sleep, does not return on the Core2
+};
+
+/*
+  countdown_shutdown()
+
+  Description:
+  ------------
+  * Timer has expired: run the shutdown steps in order
+  * "Off" is published first so the appliance is switched off even if saving state
+    fails, and sleep is always reached even if the publish failed
+
+  Return:
+  -------
+  * Result of publish_off, only seen when sleep returns (on the host)
+*/
+static inline bool countdown_shutdown(const shutdown_steps& steps) {
+  bool sent = steps.publish_off();
+  steps.save_state();
+  steps.display_off();
+  steps.sleep();
+  return sent;
+}
+
+// Timing of loop() iterations, reset after each report
+struct loop_stats {
+  uint32_t iterations;
+  uint32_t total_us;
+  uint32_t max_us;
+  uint32_t over_budget;  // Iterations that took longer than the budget
+};
+
+static inline void loop_stats_add(loop_stats& stats, uint32_t us, uint32_t budget_us) {
+  stats.iterations++;
+  stats.total_us += us;
+  if (us > stats.max_us) stats.max_us = us;
+  if (us > budget_us) stats.over_budget++;
+}
+
+static inline uint32_t loop_stats_avg_us(const loop_stats& stats) {
+  return stats.iterations ? stats.total_us / stats.iterations : 0;
+}
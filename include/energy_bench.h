@@ -0,0 +1,136 @@
+/*
+  energy_bench.h
+
+  Description:
+  ------------
+  * Energy benchmark: run the device through a fixed list of scenarios and integrate
+    the current drawn from the AXP192 over each one
+  * The result of each scenario is one line of JSON, so runs from different firmware
+    versions can be collected and compared by a script
+  * main.cpp drives the scenarios and reads the PMU
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define bench_scenario_ms 60000  // Length of each scenario
+#define bench_sample_ms   100    // PMU current sample period
+
+enum bench_scenario : uint8_t {
+  BENCH_IDLE = 0,    // Countdown screen, nothing else happening
+  BENCH_TOUCH,       // Bar graph dragged end to end, as the touch slider does
+  BENCH_OTA,         // OTA screen with progress updates and the radio kept awake
+  BENCH_RECONNECT,   // MQTT dropped and reconnected as fast as reconnect() allows
+  BENCH_SCREEN_OFF,  // LCD and backlight off
+  BENCH_COUNT,
+};
+
+static const char* const bench_scenario_names[BENCH_COUNT] = {"idle", "touch", "ota", "reconnect", "screen_off"};
+
+// Current integrated over one scenario
+struct energy_acc {
+  uint64_t ma_ms;  // Charge, mA x ms
+  uint32_t elapsed_ms;
+  uint32_t samples;
+  float max_ma;
+  float last_ma;
+  uint32_t last_ms;
+};
+
+struct bench_run {
+  bool active;
+  bench_scenario scenario;
+  uint32_t start_ms;  // Start of the current scenario
+  energy_acc acc;
+};
+
+/*
+  energy_add()
+
+  Description:
+  ------------
+  * Add a current sample, integrated with the trapezoid rule from the previous sample
+*/
+static inline void energy_add(energy_acc& acc, float current_ma, uint32_t now_ms) {
+  if (current_ma < 0) current_ma = 0;
+
+  if (acc.samples > 0) {
+    uint32_t dt = now_ms - acc.last_ms;
+    acc.ma_ms += (uint64_t)(((acc.last_ma + current_ma) / 2) * dt);
+    acc.elapsed_ms += dt;
+  }
+  if (current_ma > acc.max_ma) acc.max_ma = current_ma;
+  acc.last_ma = current_ma;
+  acc.last_ms = now_ms;
+  acc.samples++;
+}
+
+static inline float energy_mah(const energy_acc& acc) {
+  return acc.ma_ms / 3600000.0f;
+}
+
+static inline float energy_avg_ma(const energy_acc& acc) {
+  return acc.elapsed_ms ? (float)acc.ma_ms / acc.elapsed_ms : acc.last_ma;
+}
+
+static inline void bench_start(bench_run& run, uint32_t now_ms) {
+  run = {};
+  run.active = true;
+  run.scenario = BENCH_IDLE;
+  run.start_ms = now_ms;
+}
+
+// true when the current scenario has run for bench_scenario_ms
+static inline bool bench_scenario_done(const bench_run& run, uint32_t now_ms) {
+  return run.active && now_ms - run.start_ms >= bench_scenario_ms;
+}
+
+// true while the scenario paints the bar graph itself, the countdown must leave it alone
+static inline bool bench_drives_bar(const bench_run& run) {
+  return run.active && (run.scenario == BENCH_TOUCH || run.scenario == BENCH_OTA);
+}
+
+/*
+  bench_next()
+
+  Description:
+  ------------
+  * Move on to the next scenario, clearing the accumulator
+
+  Return:
+  -------
+  * false when every scenario has been run, the benchmark is then finished
+*/
+static inline bool bench_next(bench_run& run, uint32_t now_ms) {
+  run.acc = {};
+  run.start_ms = now_ms;
+  if (run.scenario + 1 >= BENCH_COUNT) {
+    run.active = false;
+    return false;
+  }
+  run.scenario = (bench_scenario)(run.scenario + 1);
+  return true;
+}
+
+/*
+  bench_report_json()
+
+  Description:
+  ------------
+  * Format the result of the current scenario as a single line of JSON
+
+  Inputs:
+  -------
+  * fw         - firmware version string
+  * on_battery - false if USB power was connected, the figures then include charging current
+
+  Return:
+  -------
+  * Length written, as snprintf()
+*/
+static inline int bench_report_json(char* buf, uint16_t len, const bench_run& run, const char* fw, bool on_battery) {
+  return snprintf(buf, len, "{\"fw\":\"%s\",\"scenario\":\"%s\",\"ms\":%u,\"samples\":%u,\"mah\":%.4f,\"avg_ma\":%.1f,\"max_ma\":%.1f,\"on_battery\":%s}",
+                  fw, bench_scenario_names[run.scenario], (unsigned)run.acc.elapsed_ms, (unsigned)run.acc.samples,
+                  energy_mah(run.acc), energy_avg_ma(run.acc), run.acc.max_ma, on_battery ? "true" : "false");
+}
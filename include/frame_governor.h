@@ -0,0 +1,90 @@
+/*
+  frame_governor.h
+
+  Description:
+  ------------
+  * Chooses how often the display is repainted and how bright the backlight is
+  * Touch (or an OTA upload) puts it in the fast mode. It then steps down to normal and
+    idle after set quiet times, so a pause mid-drag doesn't make the slider stutter
+  * A battery below frame_low_batt_enter doubles the frame intervals and dims the
+    backlight until the battery is back above frame_low_batt_exit. The gap between the
+    two stops a noisy battery reading flipping it back and forth
+*/
+#pragma once
+
+#include <stdint.h>
+
+#define frame_active_ms      40    // Touch dragging, OTA progress
+#define frame_normal_ms      250   // Shortly after activity
+#define frame_idle_ms        1000  // Countdown only, the timer still repaints on each tick
+#define frame_active_hold_ms 1500  // Quiet time before fast drops to normal
+#define frame_normal_hold_ms 5000  // Further quiet time before normal drops to idle
+#define frame_low_batt_enter 20    // Battery percent
+#define frame_low_batt_exit  25
+#define frame_dim_percent    40    // Backlight on low battery, percent of full
+
+enum frame_mode : uint8_t {
+  FRAME_ACTIVE = 0,
+  FRAME_NORMAL,
+  FRAME_IDLE,
+};
+
+static const char* const frame_mode_names[] = {"active", "normal", "idle"};
+
+struct frame_governor {
+  frame_mode mode;
+  bool low_batt;
+  uint32_t last_activity_ms;
+};
+
+static inline void frame_gov_init(frame_governor& g, uint32_t now_ms) {
+  g.mode = FRAME_NORMAL;
+  g.low_batt = false;
+  g.last_activity_ms = now_ms;
+}
+
+// Call on user input or OTA progress
+static inline void frame_gov_activity(frame_governor& g, uint32_t now_ms) {
+  g.mode = FRAME_ACTIVE;
+  g.last_activity_ms = now_ms;
+}
+
+/*
+  frame_gov_update()
+
+  Description:
+  ------------
+  * Step down through the modes as the quiet time since the last activity grows
+*/
+static inline void frame_gov_update(frame_governor& g, uint32_t now_ms) {
+  uint32_t quiet_ms = now_ms - g.last_activity_ms;
+
+  if (quiet_ms >= frame_active_hold_ms + frame_normal_hold_ms)
+    g.mode = FRAME_IDLE;
+  else if (quiet_ms >= frame_active_hold_ms && g.mode == FRAME_ACTIVE)
+    g.mode = FRAME_NORMAL;
+}
+
+/*
+  frame_gov_battery()
+
+  Inputs:
+  -------
+  * percent        - battery charge, percent
+  * external_power - USB or ACIN connected, the battery level then doesn't matter
+*/
+static inline void frame_gov_battery(frame_governor& g, uint8_t percent, bool external_power) {
+  if (external_power || percent > frame_low_batt_exit)
+    g.low_batt = false;
+  else if (percent < frame_low_batt_enter)
+    g.low_batt = true;
+}
+
+static inline uint32_t frame_gov_interval_ms(const frame_governor& g) {
+  static const uint16_t interval[] = {frame_active_ms, frame_normal_ms, frame_idle_ms};
+  return (uint32_t)interval[g.mode] * (g.low_batt ? 2 : 1);
+}
+
+static inline uint8_t frame_gov_brightness(const frame_governor& g, uint8_t full) {
+  return g.low_batt ? (uint8_t)((full * frame_dim_percent) / 100) : full;
+}
@@ -0,0 +1,124 @@
+/*
+  led_anim.h
+
+  Description:
+  ------------
+  * Frame generator for the 10 LED RGB strip on the Core2 M5GO base
+  * main.cpp copies each frame into the FastLED buffer
+  * All brightness maths is 8-bit fixed point, i.e. 255 = 1.0
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Same memory layout as FastLED CRGB
+struct led_rgb {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+};
+
+enum led_mode : uint8_t {
+  LED_MODE_OFF = 0,     // All LEDs dark, e.g. before deep sleep
+  LED_MODE_CONNECTING,  // WiFi / MQTT not connected - blue chaser
+  LED_MODE_COUNTDOWN,   // Bar of LEDs proportional to time left, green -> red
+  LED_MODE_WARNING,     // About to switch off - flashing red
+};
+
+// Remaining time palette, index 0 = no time left, index 15 = full timer
+static const led_rgb led_time_palette[16] = {
+    {255, 0, 0}, {255, 24, 0}, {255, 48, 0}, {255, 72, 0},
+    {255, 96, 0}, {255, 120, 0}, {255, 144, 0}, {255, 168, 0},
+    {224, 192, 0}, {192, 208, 0}, {160, 224, 0}, {128, 232, 0},
+    {96, 240, 0}, {64, 248, 0}, {32, 255, 0}, {0, 255, 0}};
+
+// Tail brightness of the connecting chaser, head first
+static const uint8_t led_chase_tail[4] = {255, 96, 32, 8};
+
+/*
+  led_scale8()
+
+  Description:
+  ------------
+  * Scale an 8-bit value by an 8-bit fraction, scale = 255 is unity
+*/
+static inline uint8_t led_scale8(uint8_t val, uint8_t scale) {
+  return (uint8_t)(((uint16_t)val * (uint16_t)(scale + 1)) >> 8);
+}
+
+static inline led_rgb led_scale(led_rgb c, uint8_t scale) {
+  return {led_scale8(c.r, scale), led_scale8(c.g, scale), led_scale8(c.b, scale)};
+}
+
+/*
+  led_triwave8()
+
+  Description:
+  ------------
+  * Triangle wave, phase 0..255 in, 0..255..0 out
+*/
+static inline uint8_t led_triwave8(uint8_t phase) {
+  if (phase & 0x80) phase = 255 - phase;
+  return (uint8_t)(phase << 1);
+}
+
+/*
+  led_anim_frame()
+
+  Description:
+  ------------
+  * Render one frame of the status animation
+
+  Inputs:
+  -------
+  * leds    - output buffer, count entries
+  * count   - number of LEDs in the strip
+  * mode    - what to show
+  * percent - time remaining 0% to 100%, used by countdown mode
+  * frame   - free running frame counter, drives the animation phase
+*/
+static inline void led_anim_frame(led_rgb* leds, uint8_t count, led_mode mode, uint8_t percent, uint32_t frame) {
+  if (percent > 100) percent = 100;
+
+  for (uint8_t i = 0; i < count; i++)
+    leds[i] = {0, 0, 0};
+
+  switch (mode) {
+    case LED_MODE_OFF:
+      break;
+
+    case LED_MODE_CONNECTING: {
+      // One LED step every 2 frames, with a fading tail behind it
+      uint8_t head = (frame / 2) % count;
+      for (uint8_t t = 0; t < sizeof(led_chase_tail); t++) {
+        uint8_t pos = (head + count - (t % count)) % count;
+        leds[pos] = {0, 0, led_chase_tail[t]};
+      }
+      break;
+    }
+
+    case LED_MODE_COUNTDOWN: {
+      // Number of lit LEDs in 8.8 fixed point, the last LED is partially lit
+      uint16_t lit_fp = (uint16_t)(((uint32_t)percent * count * 256) / 100);
+      led_rgb colour = led_time_palette[(percent * 15) / 100];
+      // Slow breathing between 50% and 100% brightness, one cycle per 128 frames
+      uint8_t breath = 128 + (led_triwave8((uint8_t)(frame * 2)) >> 1);
+      for (uint8_t i = 0; i < count; i++) {
+        uint16_t led_start = (uint16_t)i << 8;
+        if (lit_fp >= led_start + 256)
+          leds[i] = led_scale(colour, breath);
+        else if (lit_fp > led_start)
+          leds[i] = led_scale(led_scale(colour, breath), (uint8_t)(lit_fp - led_start));
+      }
+      break;
+    }
+
+    case LED_MODE_WARNING: {
+      // Whole strip flashes red, one cycle per 16 frames
+      led_rgb red = led_scale({255, 0, 0}, led_triwave8((uint8_t)(frame * 16)));
+      for (uint8_t i = 0; i < count; i++)
+        leds[i] = red;
+      break;
+    }
+  }
+}
@@ -0,0 +1,128 @@
+/*
+  motion.h
+
+  Description:
+  ------------
+  * Motion classifier for batches of accelerometer samples read from the IMU FIFO
+  * Per axis gravity is tracked with a fixed point low pass filter, and the L1 distance of
+    each sample from it is the motion signal - no floats, no square roots
+  * A leaky counter gives the duration check: it counts up on active samples and down on
+    quiet ones, and motion is reported when it reaches motion_min_active
+  * The IMU buffers samples in its FIFO and the CPU wakes every motion_read_ms to read
+    them as one batch, motion_read_due() keeps those wakes on a fixed grid
+*/
+#pragma once
+
+#include <stdint.h>
+
+#define motion_threshold_mg 80     // Deviation from gravity that counts as moving
+#define motion_min_active   10     // Active samples needed, 200ms of movement at 50Hz
+#define motion_max_active   50     // Leaky counter ceiling
+#define motion_lp_shift     5      // Low pass filter, new = old + (sample - old) / 32
+#define motion_cooldown_ms  10000  // Report motion at most every 10 seconds
+#define motion_read_ms      500    // FIFO read interval, 25 samples per batch at 50Hz
+
+struct accel_sample {
+  int16_t x;
+  int16_t y;
+  int16_t z;
+};
+
+struct motion_classifier {
+  int32_t lp[3];  // Gravity estimate per axis, raw counts << motion_lp_shift
+  uint16_t threshold;  // motion_threshold_mg converted to raw counts
+  uint8_t active;      // Leaky counter
+  bool primed;         // Low pass seeded from the first sample
+  bool reported;       // Reported at least once, cooldown applies
+  uint32_t last_report_ms;
+  uint32_t last_read_ms;  // FIFO read schedule, see motion_read_due()
+};
+
+/*
+  motion_init()
+
+  Inputs:
+  -------
+  * counts_per_g - accelerometer scale, e.g. 4096 for the +-8g range
+*/
+static inline void motion_init(motion_classifier& m, uint16_t counts_per_g) {
+  m = {};
+  m.threshold = (uint16_t)(((uint32_t)motion_threshold_mg * counts_per_g) / 1000);
+}
+
+/*
+  motion_read_due()
+
+  Description:
+  ------------
+  * Check if the FIFO batch should be read now. Reads stay on a motion_read_ms grid so
+    a late loop() doesn't add up to fewer wakes, unless it is a whole interval behind
+
+  Inputs:
+  -------
+  * now_ms - current time, millis()
+*/
+static inline bool motion_read_due(motion_classifier& m, uint32_t now_ms) {
+  if (now_ms - m.last_read_ms < motion_read_ms)
+    return false;
+
+  m.last_read_ms += motion_read_ms;
+  if (now_ms - m.last_read_ms >= motion_read_ms) m.last_read_ms = now_ms;
+  return true;
+}
+
+static inline int32_t motion_abs(int32_t v) {
+  return v < 0 ? -v : v;
+}
+
+/*
+  motion_feed()
+
+  Description:
+  ------------
+  * Run a batch of samples through the classifier
+
+  Inputs:
+  -------
+  * samples - accelerometer samples, oldest first
+  * count   - number of samples
+  * now_ms  - time the batch was read
+
+  Return:
+  -------
+  * true if the user is moving the appliance and the timer should be extended
+*/
+static inline bool motion_feed(motion_classifier& m, const accel_sample* samples, uint16_t count, uint32_t now_ms) {
+  bool moving = false;
+
+  for (uint16_t i = 0; i < count; i++) {
+    const int32_t axis[3] = {samples[i].x, samples[i].y, samples[i].z};
+
+    if (!m.primed) {
+      for (uint8_t a = 0; a < 3; a++)
+        m.lp[a] = axis[a] << motion_lp_shift;
+      m.primed = true;
+    }
+
+    int32_t deviation = 0;
+    for (uint8_t a = 0; a < 3; a++) {
+      m.lp[a] += axis[a] - (m.lp[a] >> motion_lp_shift);
+      deviation += motion_abs(axis[a] - (m.lp[a] >> motion_lp_shift));
+    }
+
+    if (deviation > m.threshold) {
+      if (m.active < motion_max_active) m.active++;
+    } else if (m.active > 0) {
+      m.active--;
+    }
+    if (m.active >= motion_min_active)
+      moving = true;
+  }
+
+  if (!moving || (m.reported && (now_ms - m.last_report_ms < motion_cooldown_ms)))
+    return false;
+
+  m.reported = true;
+  m.last_report_ms = now_ms;
+  return true;
+}
@@ -0,0 +1,190 @@
+/*
+  net_power.h
+
+  Description:
+  ------------
+  * Network power policy for WiFi modem sleep. With WIFI_PS_MAX_MODEM the radio only
+    wakes every listen interval (a few AP beacons) to collect buffered packets
+  * Network servicing (MQTT loop and keepalive, UDP receive and send) is done in windows
+    on the same period and, once aligned with the AP's TSF, just after each wake, so
+    outgoing packets are batched into the times the radio is awake anyway instead of
+    waking it at random
+  * Publishes made between windows wait in a small queue, see net_pub_push()
+  * Also keeps the numbers needed to trade latency against battery: an estimate of radio
+    on time and the measured round trip to a peer, which includes the sleep delay
+  * main.cpp does the networking
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define net_beacon_us     102400  // Standard AP beacon interval, 100 TU of 1024 us
+#define net_beacon_rx_ms  3       // Radio on time to receive one beacon, estimate
+#define net_packet_air_ms 2       // Radio on time per packet sent or received, estimate
+#define net_wake_rx_us    4000    // A window opens this long after the beacon, when the buffered packets are in
+#define net_topic_len     32      // Longest topic a queued publish can hold, with the terminator
+#define net_pub_queue_len 4       // Publishes waiting for the next window
+
+struct net_window {
+  uint32_t period_us;
+  uint32_t next_us;  // micros() of the next window
+};
+
+// A publish waiting for the next window. The topic is a copy, the caller's may have changed by then
+struct net_pub {
+  char topic[net_topic_len];
+  const char* payload;  // String literal
+  bool keep;            // Never dropped or merged, e.g. switching an appliance off
+};
+
+struct net_pub_queue {
+  net_pub msgs[net_pub_queue_len];
+  uint8_t count;
+};
+
+// Counters for the power and latency report, reset after each report
+struct net_stats {
+  uint32_t windows;
+  uint32_t packets;  // Sent and received, as counted by the caller
+  uint32_t rtt_count;
+  uint32_t rtt_total_ms;
+  uint32_t rtt_max_ms;
+};
+
+/*
+  net_window_init()
+
+  Inputs:
+  -------
+  * listen_interval - beacons between radio wakes, the window period is the same.
+                      0 makes every call a window, for when power save is off
+*/
+static inline void net_window_init(net_window& w, uint8_t listen_interval, uint32_t now_us) {
+  w.period_us = (uint32_t)listen_interval * net_beacon_us;
+  w.next_us = now_us;
+}
+
+/*
+  net_window_due()
+
+  Description:
+  ------------
+  * true once per window period. A late call does not cause a burst of windows to
+    catch up, the next window is a full period later
+*/
+static inline bool net_window_due(net_window& w, uint32_t now_us) {
+  if ((int32_t)(now_us - w.next_us) < 0)
+    return false;
+  w.next_us += w.period_us;
+  if ((int32_t)(now_us - w.next_us) >= 0)
+    w.next_us = now_us + w.period_us;
+  return true;
+}
+
+/*
+  net_window_align()
+
+  Description:
+  ------------
+  * Put the windows on the radio's wakes. The AP sends a beacon whenever its TSF timer
+    is a multiple of the beacon interval, and in modem sleep the station wakes for one
+    beacon in every listen interval, so the TSF tells where the next wake falls
+  * The window opens net_wake_rx_us after the beacon, once the AP has delivered what it
+    buffered, and anything sent in it goes out while the radio is still on
+  * micros() and the AP clock drift apart by up to ~100 ppm, call again every few seconds
+
+  Inputs:
+  -------
+  * tsf_us - AP TSF time now, 0 until the first beacon has been received
+  * now_us - micros() read at the same time
+
+  Return:
+  -------
+  * false if there is nothing to align to: no TSF yet, or a window on every call
+*/
+static inline bool net_window_align(net_window& w, int64_t tsf_us, uint32_t now_us) {
+  if (tsf_us <= 0 || w.period_us == 0)
+    return false;
+  uint32_t since_wake = (uint32_t)((uint64_t)tsf_us % w.period_us);
+  w.next_us = now_us - since_wake + net_wake_rx_us;
+  if ((int32_t)(now_us - w.next_us) >= 0)
+    w.next_us += w.period_us;
+  return true;
+}
+
+static inline void net_stats_rtt(net_stats& s, uint32_t rtt_ms) {
+  s.rtt_count++;
+  s.rtt_total_ms += rtt_ms;
+  if (rtt_ms > s.rtt_max_ms) s.rtt_max_ms = rtt_ms;
+}
+
+/*
+  net_radio_on_ms()
+
+  Description:
+  ------------
+  * Estimate of the time the radio was powered over elapsed_ms: one beacon receive per
+    listen interval plus the air time of each packet. Without modem sleep
+    (listen_interval 1, every beacon) it is close to the DTIM1 figure
+
+  Return:
+  -------
+  * Estimated radio on time, ms
+*/
+static inline uint32_t net_radio_on_ms(uint32_t elapsed_ms, uint8_t listen_interval, uint32_t packets) {
+  uint32_t wakes = (uint32_t)((uint64_t)elapsed_ms * 1000 / ((uint32_t)listen_interval * net_beacon_us));
+  uint32_t on_ms = wakes * net_beacon_rx_ms + packets * net_packet_air_ms;
+  return (on_ms < elapsed_ms) ? on_ms : elapsed_ms;
+}
+
+/*
+  net_pub_push()
+
+  Description:
+  ------------
+  * Queue a publish for the next window
+  * A repeat of the last queued publish, same topic and payload, is dropped unless it is
+    a keep one. When the queue is full the oldest publish that isn't kept makes room
+
+  Inputs:
+  -------
+  * keep - the publish must not be dropped, e.g. "Off" to an appliance
+
+  Return:
+  -------
+  * false if the queue is full of kept publishes, send them first
+*/
+static inline bool net_pub_push(net_pub_queue& q, const char* topic, const char* payload, bool keep) {
+  if (q.count && !keep) {
+    const net_pub& last = q.msgs[q.count - 1];
+    if (strcmp(last.topic, topic) == 0 && strcmp(last.payload, payload) == 0)
+      return true;
+  }
+
+  if (q.count == net_pub_queue_len) {
+    uint8_t drop = 0;
+    while (drop < q.count && q.msgs[drop].keep)
+      drop++;
+    if (drop == q.count)
+      return false;
+    for (uint8_t i = drop + 1; i < q.count; i++)
+      q.msgs[i - 1] = q.msgs[i];
+    q.count--;
+  }
+
+  net_pub& m = q.msgs[q.count++];
+  strncpy(m.topic, topic, net_topic_len - 1);
+  m.topic[net_topic_len - 1] = '\0';
+  m.payload = payload;
+  m.keep = keep;
+  return true;
+}
+
+// Remove the oldest publish, once it has been sent
+static inline void net_pub_pop(net_pub_queue& q) {
+  if (q.count == 0) return;
+  for (uint8_t i = 1; i < q.count; i++)
+    q.msgs[i - 1] = q.msgs[i];
+  q.count--;
+}
@@ -0,0 +1,145 @@
+/*
+  rtc_snapshot.h
+
+  Description:
+  ------------
+  * Session snapshot kept in RTC slow memory across deep sleep
+  * Lets setup() skip the WiFi scan, DHCP and start up screens when waking
+    from the timer shutdown, and paint the last frame straight away
+  * Versioned and CRC protected: a snapshot from older firmware, or one
+    corrupted by a brown out, is ignored and the device does a cold start
+  * The DHCP address is only reused as a static IP while the lease is young enough
+    that the router can't have handed it to someone else
+  * With MQTT over TLS the session of the last broker is kept too, so the first
+    connection after a wake can resume it instead of running a full handshake
+*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef MQTT_TLS_MODE
+  #define MQTT_TLS_MODE 0
+#endif
+
+#define rtc_snapshot_magic   0x49524F4EUL  // "IRON"
+#define rtc_snapshot_version 4             // Bump whenever struct rtc_snapshot changes
+#define rtc_lease_max_sec    3600          // Reuse a DHCP address for this long, well inside a typical router lease
+#define rtc_tls_session_max  1536          // Serialised mbedTLS session, holds the broker certificate and ticket
+
+struct rtc_snapshot {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;  // sizeof(rtc_snapshot) when written
+
+  // Timer state
+  uint32_t timer_start_sec;  // Last timer setting chosen by the user
+
+  // Network cache, lets WiFi skip the channel scan and DHCP
+  uint8_t wifi_channel;
+  uint8_t wifi_bssid[6];
+  uint8_t mqtt_broker;  // Last MQTT broker that connected, tried first on resume
+  uint32_t local_ip;
+  uint32_t gateway_ip;
+  uint32_t subnet_mask;
+  uint32_t dns_ip;
+  uint32_t lease_start_sec;  // RTC clock when the address was leased by DHCP
+#if MQTT_TLS_MODE
+  uint16_t tls_session_len;  // TLS session with mqtt_broker, 0 = none
+  uint8_t tls_session[rtc_tls_session_max];
+#endif
+
+  // UI state
+  uint8_t bar_percent;  // Bar graph fill shown in the last frame
+  uint8_t pad[3];
+
+  // Instrumentation, wake to first frame of the previous boot
+  uint32_t first_frame_ms;
+  uint32_t boot_count;
+
+  uint32_t crc;  // CRC32 of everything above, must be last
+};
+
+enum rtc_snapshot_status : uint8_t {
+  RTC_SNAPSHOT_OK = 0,
+  RTC_SNAPSHOT_EMPTY,     // Never written, e.g. power on reset
+  RTC_SNAPSHOT_VERSION,   // Written by different firmware version
+  RTC_SNAPSHOT_CORRUPT,   // Size or CRC mismatch
+};
+
+/*
+  rtc_snapshot_crc32()
+
+  Description:
+  ------------
+  * Bitwise CRC32 (IEEE 802.3), small and table free - only runs once per boot
+*/
+static inline uint32_t rtc_snapshot_crc32(const uint8_t* data, size_t len) {
+  uint32_t crc = 0xFFFFFFFFUL;
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1)));
+  }
+  return ~crc;
+}
+
+static inline uint32_t rtc_snapshot_calc_crc(const rtc_snapshot* snap) {
+  return rtc_snapshot_crc32(reinterpret_cast<const uint8_t*>(snap), offsetof(rtc_snapshot, crc));
+}
+
+/*
+  rtc_snapshot_seal()
+
+  Description:
+  ------------
+  * Stamp magic, version and size and calculate the CRC, call after filling in the fields
+*/
+static inline void rtc_snapshot_seal(rtc_snapshot* snap) {
+  snap->magic = rtc_snapshot_magic;
+  snap->version = rtc_snapshot_version;
+  snap->size = sizeof(rtc_snapshot);
+  snap->crc = rtc_snapshot_calc_crc(snap);
+}
+
+/*
+  rtc_snapshot_check()
+
+  Description:
+  ------------
+  * Validate a snapshot read back from RTC memory
+
+  Return:
+  -------
+  * RTC_SNAPSHOT_OK if the snapshot can be used to resume
+*/
+static inline rtc_snapshot_status rtc_snapshot_check(const rtc_snapshot* snap) {
+  if (snap->magic != rtc_snapshot_magic)
+    return RTC_SNAPSHOT_EMPTY;
+  if (snap->version != rtc_snapshot_version)
+    return RTC_SNAPSHOT_VERSION;
+  if (snap->size != sizeof(rtc_snapshot) || snap->crc != rtc_snapshot_calc_crc(snap))
+    return RTC_SNAPSHOT_CORRUPT;
+  return RTC_SNAPSHOT_OK;
+}
+
+static inline void rtc_snapshot_invalidate(rtc_snapshot* snap) {
+  memset(snap, 0, sizeof(rtc_snapshot));
+}
+
+/*
+  rtc_snapshot_lease_valid()
+
+  Description:
+  ------------
+  * true if the cached address can still be used as a static IP. The RTC clock keeps
+    running through deep sleep, a clock that went backwards (power loss) counts as expired
+
+  Inputs:
+  -------
+  * now_sec - RTC clock, seconds
+*/
+static inline bool rtc_snapshot_lease_valid(const rtc_snapshot* snap, uint32_t now_sec) {
+  return snap->local_ip != 0 && now_sec - snap->lease_start_sec < rtc_lease_max_sec;
+}
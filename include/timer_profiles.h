@@ -0,0 +1,128 @@
+/*
+  timer_profiles.h
+
+  Description:
+  ------------
+  * Named timer profiles, one per appliance, e.g. soldering iron, glue gun
+  * Each profile is a fixed 64 byte record with its own CRC, stored as one NVS blob per
+    profile so only the profile in use has to be read at boot
+  * main.cpp does the NVS reads and writes
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rtc_snapshot.h"  // rtc_snapshot_crc32()
+
+#define max_profiles         4
+#define profile_name_len     12
+#define profile_topic_len    20
+#define profile_format_ver   1
+#define profile_min_duration 30     // Seconds
+#define profile_max_duration 5999   // 99:59, the longest the mm:ss timer text can show
+
+struct timer_profile {
+  uint8_t version;
+  uint8_t warning_sec;    // Show the "Switch off in" warning with this many seconds left
+  uint16_t duration_sec;  // Full timer
+  uint16_t step_sec;      // Button 1 / 2 click adjusts the timer by this much
+  uint16_t reserved;
+  char name[profile_name_len];
+  char state_topic[profile_topic_len];
+  char cmd_topic[profile_topic_len];
+  uint32_t crc;  // CRC32 of everything above, must be last
+};
+static_assert(sizeof(timer_profile) == 64, "timer_profile record size changed, bump profile_format_ver");
+
+// Built in profiles, used until a profile has been saved to NVS
+static const timer_profile default_profiles[max_profiles] = {
+    {profile_format_ver, 5, 300, 120, 0, "Iron", "iron_switch", "iron_cmd", 0},
+    {profile_format_ver, 15, 900, 300, 0, "Glue gun", "glue_switch", "glue_cmd", 0},
+    {profile_format_ver, 10, 180, 60, 0, "Heat gun", "heatgun_switch", "heatgun_cmd", 0},
+    {profile_format_ver, 30, 1800, 600, 0, "Oven", "oven_switch", "oven_cmd", 0},
+};
+
+static inline uint32_t profile_calc_crc(const timer_profile* p) {
+  return rtc_snapshot_crc32(reinterpret_cast<const uint8_t*>(p), sizeof(timer_profile) - sizeof(p->crc));
+}
+
+static inline void profile_seal(timer_profile* p) {
+  p->version = profile_format_ver;
+  p->name[profile_name_len - 1] = '\0';
+  p->state_topic[profile_topic_len - 1] = '\0';
+  p->cmd_topic[profile_topic_len - 1] = '\0';
+  p->crc = profile_calc_crc(p);
+}
+
+/*
+  profile_valid()
+
+  Description:
+  ------------
+  * Check a profile record read back from NVS, including sane timer values
+
+  Return:
+  -------
+  * true if the record can be used
+*/
+static inline bool profile_valid(const timer_profile* p) {
+  if (p->version != profile_format_ver || p->crc != profile_calc_crc(p))
+    return false;
+  if (p->duration_sec < profile_min_duration || p->duration_sec > profile_max_duration)
+    return false;
+  if (p->step_sec == 0 || p->step_sec > p->duration_sec || p->warning_sec >= p->duration_sec)
+    return false;
+  return p->name[0] != '\0' && p->state_topic[0] != '\0' && p->cmd_topic[0] != '\0';
+}
+
+/*
+  profile_scale_ticks()
+
+  Description:
+  ------------
+  * Pick the number of major ticks for the bar graph scale so every tick lands on a whole
+    number of minutes, e.g. 3 ticks for 3 minutes, 6 ticks for 30 minutes
+
+  Inputs:
+  -------
+  * duration_sec - full timer length
+
+  Return:
+  -------
+  * 2 to 6 major ticks
+*/
+static inline uint8_t profile_scale_ticks(uint16_t duration_sec) {
+  static const uint8_t candidates[] = {6, 5, 4, 3, 2};
+  uint16_t minutes = duration_sec / 60;
+
+  if (duration_sec % 60 == 0) {
+    for (uint8_t i = 0; i < sizeof(candidates); i++)
+      if (candidates[i] <= minutes && minutes % candidates[i] == 0)
+        return candidates[i];
+  }
+  return 5;
+}
+
+/*
+  profile_scale_label()
+
+  Description:
+  ------------
+  * Text for a major tick of the minutes scale. Whole minutes are shown as just the
+    number, anything else (a duration that isn't a whole number of minutes) as m:ss
+
+  Inputs:
+  -------
+  * tick        - major tick number, 0 at the left hand end
+  * major_ticks - from profile_scale_ticks()
+*/
+static inline void profile_scale_label(char* buf, uint8_t len, uint16_t duration_sec, uint8_t tick, uint8_t major_ticks) {
+  uint32_t sec = ((uint32_t)tick * duration_sec) / major_ticks;
+
+  if (sec % 60 == 0)
+    snprintf(buf, len, "%u", (unsigned)(sec / 60));
+  else
+    snprintf(buf, len, "%u:%02u", (unsigned)(sec / 60), (unsigned)(sec % 60));
+}
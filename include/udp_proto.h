@@ -0,0 +1,172 @@
+/*
+  udp_proto.h
+
+  Description:
+  ------------
+  * Small CoAP style datagram protocol for on-LAN status and control, used alongside MQTT
+  * 6 byte header followed by an optional payload:
+      byte 0    version (upper 2 bits) and message type (lower 2 bits)
+      byte 1    code, see udp_code
+      byte 2-3  message ID, big endian, echoed in the ACK
+      byte 4-5  timer seconds remaining, big endian
+  * Confirmable (CON) messages are retransmitted with exponential back off until ACKed,
+    non-confirmable (NON) messages are fire and forget
+  * EXTEND keeps the appliance on, so it carries a shared token as its payload and is
+    refused without it. OFF and PING need no token, anyone on the LAN can switch off
+  * main.cpp does the sending and receiving
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define udp_proto_version  1
+#define udp_port           5683  // Same as CoAP
+#define udp_header_len     6
+#define udp_max_payload    32
+#define udp_ack_timeout_ms 250  // First retransmit, doubled each time
+#define udp_max_retransmit 4
+
+enum udp_type : uint8_t {
+  UDP_CON = 0,  // Confirmable, must be ACKed
+  UDP_NON = 1,  // Non-confirmable
+  UDP_ACK = 2,
+  UDP_RST = 3,  // Rejected, e.g. unknown code
+};
+
+enum udp_code : uint8_t {
+  UDP_CODE_EMPTY = 0,
+  UDP_CODE_STATUS = 1,  // Device -> peer: timer state, payload = profile name
+  UDP_CODE_EXTEND = 2,  // Peer -> device: add the profile step to the timer, payload = token
+  UDP_CODE_OFF = 3,     // Peer -> device: switch off now
+  UDP_CODE_PING = 4,    // Peer -> device: reply with ACK carrying the status
+};
+
+struct udp_msg {
+  udp_type type;
+  udp_code code;
+  uint16_t msg_id;
+  uint16_t timer_sec;
+  uint8_t payload_len;
+  uint8_t payload[udp_max_payload];
+};
+
+/*
+  udp_encode()
+
+  Description:
+  ------------
+  * Serialise a message into buf
+
+  Return:
+  -------
+  * Number of bytes written, 0 if buf is too small
+*/
+static inline uint16_t udp_encode(const udp_msg& msg, uint8_t* buf, uint16_t buf_len) {
+  uint8_t payload_len = (msg.payload_len > udp_max_payload) ? udp_max_payload : msg.payload_len;
+  if (buf_len < udp_header_len + payload_len)
+    return 0;
+
+  buf[0] = (uint8_t)((udp_proto_version << 6) | (msg.type & 0x03));
+  buf[1] = msg.code;
+  buf[2] = (uint8_t)(msg.msg_id >> 8);
+  buf[3] = (uint8_t)(msg.msg_id & 0xFF);
+  buf[4] = (uint8_t)(msg.timer_sec >> 8);
+  buf[5] = (uint8_t)(msg.timer_sec & 0xFF);
+  memcpy(buf + udp_header_len, msg.payload, payload_len);
+  return udp_header_len + payload_len;
+}
+
+/*
+  udp_decode()
+
+  Description:
+  ------------
+  * Parse a received datagram
+
+  Return:
+  -------
+  * false if the datagram is too short or from another protocol version
+*/
+static inline bool udp_decode(const uint8_t* buf, uint16_t len, udp_msg& msg) {
+  if (len < udp_header_len || (buf[0] >> 6) != udp_proto_version)
+    return false;
+
+  msg.type = (udp_type)(buf[0] & 0x03);
+  msg.code = (udp_code)buf[1];
+  msg.msg_id = (uint16_t)((buf[2] << 8) | buf[3]);
+  msg.timer_sec = (uint16_t)((buf[4] << 8) | buf[5]);
+  msg.payload_len = (len - udp_header_len > udp_max_payload) ? udp_max_payload : (uint8_t)(len - udp_header_len);
+  memcpy(msg.payload, buf + udp_header_len, msg.payload_len);
+  return true;
+}
+
+// One outstanding confirmable message waiting for its ACK
+struct udp_pending {
+  bool active;
+  uint8_t retransmits;
+  uint32_t next_send_ms;
+  uint16_t timeout_ms;
+  udp_msg msg;
+};
+
+static inline void udp_pending_start(udp_pending& p, const udp_msg& msg, uint32_t now_ms) {
+  p.active = true;
+  p.retransmits = 0;
+  p.timeout_ms = udp_ack_timeout_ms;
+  p.next_send_ms = now_ms;
+  p.msg = msg;
+}
+
+/*
+  udp_pending_due()
+
+  Description:
+  ------------
+  * Check if the pending message should be (re)sent now. Gives up after udp_max_retransmit
+
+  Return:
+  -------
+  * true if the caller should send p.msg
+*/
+static inline bool udp_pending_due(udp_pending& p, uint32_t now_ms) {
+  if (!p.active || (int32_t)(now_ms - p.next_send_ms) < 0)
+    return false;
+
+  if (p.retransmits > udp_max_retransmit) {
+    p.active = false;  // No peer listening, give up
+    return false;
+  }
+  p.next_send_ms = now_ms + p.timeout_ms;
+  p.timeout_ms *= 2;
+  p.retransmits++;
+  return true;
+}
+
+// Returns true if ack matches the pending message, which is then complete
+static inline bool udp_pending_ack(udp_pending& p, const udp_msg& ack) {
+  if (!p.active || ack.type != UDP_ACK || ack.msg_id != p.msg.msg_id)
+    return false;
+  p.active = false;
+  return true;
+}
+
+/*
+  udp_token_ok()
+
+  Description:
+  ------------
+  * Check the shared token in the payload of a command. An empty token means none is
+    configured, the command is then always refused
+  * Every byte is compared, so reply timing doesn't show how much of a guess was right
+*/
+static inline bool udp_token_ok(const udp_msg& msg, const char* token) {
+  size_t len = strlen(token);
+  if (len == 0 || len > udp_max_payload || msg.payload_len != len)
+    return false;
+
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; i++)
+    diff |= msg.payload[i] ^ (uint8_t)token[i];
+  return diff == 0;
+}
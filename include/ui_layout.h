@@ -0,0 +1,90 @@
+/*
+  ui_layout.h
+
+  Description:
+  ------------
+  * Screen layout for the 320 x 240 Core2 LCD, one rectangle per widget
+  * Everything is constexpr so positions are resolved at compile time and
+    the static_asserts below catch widgets that would overlap
+*/
+#pragma once
+
+#include <stdint.h>
+
+struct ui_rect {
+  int16_t x;
+  int16_t y;
+  int16_t w;
+  int16_t h;
+
+  constexpr int16_t right() const { return x + w; }  // One past the last column
+  constexpr int16_t bottom() const { return y + h; }  // One past the last row
+  constexpr int16_t centre_x() const { return x + w / 2; }
+
+  constexpr bool overlaps(const ui_rect& o) const {
+    return x < o.right() && o.x < right() && y < o.bottom() && o.y < bottom();
+  }
+  constexpr bool contains(const ui_rect& o) const {
+    return o.x >= x && o.y >= y && o.right() <= right() && o.bottom() <= bottom();
+  }
+};
+
+namespace layout {
+
+constexpr int16_t screen_w = 320;  // The library WIDTH is the short side
+constexpr int16_t screen_h = 240;  // The library HEIGHT is the long side
+constexpr ui_rect screen = {0, 0, screen_w, screen_h};
+
+// Title bar across the top, battery icon sits on its right hand end
+constexpr ui_rect title_bar = {0, 0, screen_w, 45};
+constexpr int16_t title_txt_x_offs = 44;
+constexpr int16_t title_txt_y_offs = 8;
+constexpr int16_t version_x = 5;
+constexpr int16_t version_y = 15;
+constexpr ui_rect battery = {screen_w - 85, 0, 85, 42};
+
+// Timer bar graph with its ruler scale underneath
+constexpr int16_t tb_left_margin = 25;
+constexpr int16_t tb_right_margin = 25;
+constexpr int16_t tb_bottom_margin = 37;
+constexpr int16_t tb_height = 25;
+constexpr ui_rect bar = {tb_left_margin, screen_h - tb_height - tb_bottom_margin, screen_w - tb_left_margin - tb_right_margin, tb_height};
+constexpr ui_rect scale = {tb_left_margin - 20, screen_h - tb_bottom_margin + 1, bar.w + 30, tb_bottom_margin - 2};
+
+// x of scale tick n of count, spread over the full bar width without rounding error building up
+constexpr int16_t scale_tick_x(uint8_t n, uint8_t count) {
+  return bar.x + (int16_t)(((int32_t)n * bar.w) / count);
+}
+
+// Area between the title bar and bar graph, shared by the screens
+constexpr ui_rect centre = {2, title_bar.bottom() + 1, screen_w - 4, bar.y - title_bar.bottom() - 5};
+
+// Count down screen
+constexpr ui_rect timer_msg = {10, screen_h / 2 - 50, screen_w - 20, 42};
+constexpr ui_rect timer_text = {screen_w / 2 - 135 / 2, timer_msg.y + 53, 135, 42};
+
+// Start up screen, WiFi connecting message with progress dots underneath
+constexpr ui_rect startup = {10, timer_msg.y, screen_w - 20, 80};
+constexpr int16_t startup_dots_x = 110;
+constexpr int16_t startup_dots_y = 120;
+
+// OTA update screen
+constexpr ui_rect ota_title = {10, title_bar.bottom() + 15, screen_w - 20, 42};
+constexpr ui_rect ota_ip = {20, ota_title.y + 50, 160, 22};
+constexpr ui_rect ota_rssi = {190, ota_ip.y, 120, 22};
+constexpr ui_rect ota_percent = {screen_w / 2 - 40, screen_h - 100, 80, 36};
+constexpr ui_rect ota_status = {10, title_bar.bottom() + 15, screen_w - 20, 110};
+
+// Power management debug panel
+constexpr ui_rect pmu = {0, 50, 200, screen_h - 55};
+
+static_assert(!title_bar.overlaps(centre), "centre area overlaps title bar");
+static_assert(!bar.overlaps(scale), "bar graph overlaps its scale");
+static_assert(!centre.overlaps(bar), "centre area overlaps bar graph");
+static_assert(centre.contains(timer_msg) && centre.contains(timer_text), "count down widgets must fit the centre area");
+static_assert(!timer_msg.overlaps(timer_text), "timer message overlaps timer text");
+static_assert(centre.contains(ota_title) && centre.contains(ota_ip) && centre.contains(ota_rssi), "OTA widgets must fit the centre area");
+static_assert(!ota_ip.overlaps(ota_rssi), "OTA IP overlaps RSSI");
+static_assert(screen.contains(pmu) && !pmu.overlaps(battery), "PMU panel overlaps battery icon");
+
+}  // namespace layout
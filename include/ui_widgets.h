@@ -0,0 +1,121 @@
+/*
+  ui_widgets.h
+
+  Description:
+  ------------
+  * Retained mode widget tree for the LCD
+  * Each widget owns a fixed rectangle from ui_layout.h, a paint callback and a dirty flag
+  * A screen is just the set of widgets that are visible. Switching screens erases the
+    widgets that disappear and paints the ones that appear - widgets common to both
+    screens (title bar, battery, bar graph...) are left alone
+  * ui_render() only paints dirty widgets and times each paint, so render cost per
+    screen can be measured
+  * The caller provides the paint, erase and microsecond clock callbacks
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include "ui_layout.h"
+
+typedef void (*ui_paint_fn)(const ui_rect& r);
+typedef uint32_t (*ui_clock_fn)();
+
+struct ui_widget {
+  const char* name;
+  ui_rect rect;
+  ui_paint_fn paint;
+  bool dirty;
+  uint32_t paint_us;  // Cost of the last paint
+};
+
+struct ui_render_stats {
+  uint8_t painted;  // Widgets painted
+  uint8_t erased;   // Widgets erased by the last screen change
+  uint32_t us;      // Total time taken
+};
+
+struct ui_tree {
+  ui_widget* widgets;
+  uint8_t count;
+  uint32_t visible;  // Bit n set = widget n is on screen
+  ui_paint_fn erase;
+  ui_clock_fn clock_us;
+  uint8_t pending_erased;
+};
+
+#define ui_bit(id) (1UL << (id))
+
+static inline void ui_invalidate(ui_tree& ui, uint8_t id) {
+  if (id < ui.count) ui.widgets[id].dirty = true;
+}
+
+static inline bool ui_is_visible(const ui_tree& ui, uint8_t id) {
+  return (ui.visible & ui_bit(id)) != 0;
+}
+
+/*
+  ui_show()
+
+  Description:
+  ------------
+  * Change screen. Widgets leaving the screen are erased straight away, unless an
+    incoming widget completely covers them. Widgets arriving are marked dirty
+
+  Inputs:
+  -------
+  * mask - bit mask of the widgets making up the new screen
+*/
+static inline void ui_show(ui_tree& ui, uint32_t mask) {
+  uint32_t leaving = ui.visible & ~mask;
+  uint32_t arriving = mask & ~ui.visible;
+
+  for (uint8_t id = 0; id < ui.count; id++) {
+    if (!(leaving & ui_bit(id))) continue;
+
+    bool covered = false;
+    for (uint8_t other = 0; other < ui.count && !covered; other++)
+      covered = (arriving & ui_bit(other)) && ui.widgets[other].rect.contains(ui.widgets[id].rect);
+
+    if (!covered) {
+      ui.erase(ui.widgets[id].rect);
+      ui.pending_erased++;
+    }
+  }
+
+  for (uint8_t id = 0; id < ui.count; id++)
+    if (arriving & ui_bit(id)) ui.widgets[id].dirty = true;
+
+  ui.visible = mask;
+}
+
+/*
+  ui_render()
+
+  Description:
+  ------------
+  * Paint every visible dirty widget, in widget order
+
+  Return:
+  -------
+  * Number of widgets painted and erased since the last render, and the time taken
+*/
+static inline ui_render_stats ui_render(ui_tree& ui) {
+  ui_render_stats stats = {0, ui.pending_erased, 0};
+  uint32_t start = ui.clock_us();
+
+  for (uint8_t id = 0; id < ui.count; id++) {
+    ui_widget& w = ui.widgets[id];
+    if (!w.dirty || !(ui.visible & ui_bit(id))) continue;
+
+    uint32_t t0 = ui.clock_us();
+    w.paint(w.rect);
+    w.paint_us = ui.clock_us() - t0;
+    w.dirty = false;
+    stats.painted++;
+  }
+
+  stats.us = ui.clock_us() - start;
+  ui.pending_erased = 0;
+  return stats;
+}
@@ -1,122 +1,448 @@
 #include <ArduinoOTA.h>
+#include <FastLED.h>
 #include <M5Unified.h>
 #include <OneButton.h>
+#include <Preferences.h>
 #include <PubSubClient.h>
 #include <WiFi.h>
 #include <WiFiUdp.h>
-
+#include <esp_wifi.h>
+#include <sys/time.h>
+
+// MQTT transport: 0 = plain TCP, 1 = TLS verified with a CA certificate, resuming the last session
+// Set with build_flags in platformio.ini, e.g. -DMQTT_TLS_MODE=1
+#ifndef MQTT_TLS_MODE
+  #define MQTT_TLS_MODE 0
+#endif
+
+#if MQTT_TLS_MODE
+  #include "mqtt_tls_credentials.h"  // MQTT_CA_CERT, tools/tls_broker.sh writes one for a local test broker
+  #include "tls_client.h"
+#endif
+
+// 1 = time the log call against snprintf once at boot, see binlog_benchmark()
+#ifndef BINLOG_BENCH
+  #define BINLOG_BENCH 0
+#endif
+
+#include "alert_queue.h"
+#include "binlog.h"
+#include "broker_list.h"
+#include "broker_race.h"
+#include "countdown.h"
+#include "energy_bench.h"
+#include "frame_governor.h"
+#include "led_anim.h"
+#include "motion.h"
+#include "net_power.h"
+#include "rtc_snapshot.h"
+#include "timer_profiles.h"
+#include "udp_proto.h"
+#include "ui_widgets.h"
 #include "wifi_credentials.h"
 
+// Shared token for UDP commands that keep the appliance on. Define it in wifi_credentials.h, or in
+// build_flags as -DUDP_TOKEN=\"secret\". Empty refuses those commands, OFF and PING still work
+#ifndef UDP_TOKEN
+  #define UDP_TOKEN ""
+#endif
+
 const char* ssid = WIFI_SSID;
 const char* password = WIFI_PASSWD;
 
 // MQTT settings
-IPAddress mqttServer(192, 168, 20, 2);  // MQTT Server IP address, i.e. ESPHome IP address
+#if MQTT_TLS_MODE
+const int mqttPort = 8883;
+#else
 const int mqttPort = 1883;
+#endif
+mqtt_broker mqtt_brokers[] = {
+    {IPAddress(192, 168, 20, 2), mqttPort},  // Preferred broker, i.e. ESPHome IP address
+    {IPAddress(192, 168, 20, 3), mqttPort},  // Fallback broker when ESPHome is down
+};
+broker_list mqtt_broker_list = {mqtt_brokers, sizeof(mqtt_brokers) / sizeof(mqtt_brokers[0]), broker_no_pick};
+broker_race mqtt_race;  // Connections in progress, polled by reconnect()
 const char* mqttUser = "esp32";
 const char* mqttPassword = "core2";
+#if MQTT_TLS_MODE
+tls_client wifiClient;
+uint8_t tls_session_broker = broker_no_pick;  // Broker the session kept by wifiClient belongs to
+uint8_t tls_bench_rounds = 0;                 // Set by the "tlsbench" command, run from loop()
+#else
 WiFiClient wifiClient;
+#endif
 PubSubClient mqttClient(wifiClient);
-const char* stateTopic = "iron_switch";
-const char* commandTopic = "iron_cmd";
-
-#define sw_version         "v0.31"
-#define TFT_WIDTH          320  // The library WIDTH is the short side
-#define TFT_HEIGHT         240  // The library HEIGHT is the long side
-#define buz_duration       200  // When touch buttons are pressed, vibrate the motor for 200ms
-#define timer_duration_sec 300
+const char* stateTopic = default_profiles[0].state_topic;  // Both topics follow the active timer profile
+const char* commandTopic = default_profiles[0].cmd_topic;
+
+#define sw_version   "v0.31"
+#define buz_duration 200  // When touch buttons are pressed, vibrate the motor for 200ms
+
+// Alerts, see alert_queue.h. The speaker mixes one channel per alert priority
+#define alert_volume          160
+#define alert_vibration_level 180
+
+// Timer profiles, durations, steps and warning times are in timer_profiles.h
+#define profile_nvs_namespace "iron_timer"
+#define profile_save_delay_ms 10000  // Batch profile changes, only write to flash 10 seconds after the last change
+#define profile_msg_ms        2000   // Show the profile name above the timer for 2 seconds after selecting it
+
+// MQTT broker connection
+#define mqtt_connect_timeout_ms 1500  // TCP connect time limit per broker, the connect runs in the background
+#define mqtt_socket_timeout_sec 2     // Wait for the broker's CONNACK
+#define mqtt_tls_timeout_ms     3000  // TLS handshake time limit, the handshake runs one step per loop()
+#define mqtt_tls_bench_topic    "iron_timer/tlsbench"  // Results of the "tlsbench" command
+#define mqtt_tls_bench_max      20    // Handshakes of each kind per run
+
+// UDP control / status channel, see udp_proto.h
+#define udp_enabled      true
+#define udp_max_rx_batch 4  // Datagrams handled per loop() iteration
+#define mqtt_pong_topic  "iron_timer/pong"  // Reply to the "ping" command, for comparing MQTT and UDP round trips
+
+// WiFi modem sleep, see net_power.h. MQTT and UDP are serviced once per radio wake
+#define net_power_save      true
+#define net_listen_interval 3  // Beacons per radio wake, set on the radio by net_listen_interval_apply()
+#define net_align_ms        10000  // Realign the service windows with the AP's TSF this often
+#define net_ps_mode         (net_power_save ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM)
+#define mqtt_keepalive_sec  60  // Library default is 15 seconds, each PINGREQ wakes the radio
+#define net_stats_ms        60000
+
+// IMU motion detection, MPU6886 on the internal I2C bus
+#define motion_enabled      true
+#define imu_i2c_addr        0x68
+#define imu_i2c_freq        400000
+#define imu_reg_smplrt_div  0x19
+#define imu_reg_config      0x1A
+#define imu_reg_fifo_en     0x23
+#define imu_reg_user_ctrl   0x6A
+#define imu_reg_fifo_count  0x72  // High byte, low byte follows
+#define imu_reg_fifo_rw     0x74
+#define imu_sample_rate_div 19    // 1kHz / (1 + 19) = 50Hz
+#define imu_fifo_frame_len  8     // Accel X, Y, Z then temperature, 16-bit big endian each
+#define imu_fifo_max_frames 32    // Read at most this many frames per wake
+#define imu_counts_per_g    4096  // M5Unified sets the accelerometer to +-8g
+#define motion_stats_ms     60000
+
+// Deferred logging, see binlog.h. Use the blog_x() macros in loop() rather than Serial.printf
+#define binlog_drain_ms    20    // Drain task wakes this often to format and print records
+#define binlog_task_stack  3072
+#define binlog_bench_calls 32    // Calls timed by binlog_benchmark()
+
+// Energy benchmark, started with the "bench" command. Scenarios are in energy_bench.h
+#define bench_topic       "iron_timer/bench"  // One JSON line per scenario is published here
+#define bench_drag_ms     20                  // Bar graph step during the touch scenario, as the touch path
+#define bench_ota_step_ms 50                  // Progress update rate during the OTA scenario
+#define bench_json_len    200                 // One scenario's report
+
+// loop() timing
+#define loop_budget_us    50000  // An iteration taking longer than 50ms makes the touch slider feel laggy
+#define loop_stats_period 10000  // Report loop timing every 10 seconds
+
+// Screen positions are in ui_layout.h
 
 // Title bar data
-#define title_txt_x_offs 44
-#define title_txt_y_offs 8
-#define title_bar_height 45
-#define title_str        "Iron Timer"
+#define title_str "Iron Timer"
 
 // Battery icon data
-#define batt_spr_wdth    85
-#define batt_spr_ht      42
 #define batt_rect_width  16
 #define batt_rect_height 35
 #define batt_button_wdth 6
 #define batt_button_ht   4
 
 // Time text mm:ss data
-#define time_spr_wdth      135
-#define time_spr_ht        42
-#define time_spr_x         (TFT_WIDTH / 2) - (time_spr_wdth / 2)
-#define time_spr_y         time_msg_y + 53
 #define timer_txt_bg_color TFT_BLACK
 
 // Text message above time text
-#define time_msg_x               (TFT_WIDTH / 2)
-#define time_msg_y               (TFT_HEIGHT / 2 - 50)
-#define time_msg_bg_color        TFT_BLACK
-#define secs_remain_shutdown_msg 5  // At 5 seconds remaining, let the user know
-#define switch_off_msg           "Switch off in"
-#define time_left_msg            "Time Left"
-
-// Label the touch buttons at bottom of screen
-#define BtnA_x        52
-#define BtnB_x        (TFT_WIDTH / 2)
-#define BtnC_x        (TFT_WIDTH - BtnA_x - 3)
-#define Btn_tri_width 20
-#define Btn_tri_ht    (TFT_HEIGHT - 20)
+#define time_msg_bg_color TFT_BLACK
+#define switch_off_msg    "Switch off in"
+#define time_left_msg     "Time Left"
 
 // Wake on touch GPIO
 #define touch_pin_gpio          27
 #define touch_pin_low_threshold 55  // When touched, the touch reading falls. If below this value, ESP32 will reboot
 
 // Timer bar graph
-#define tb_fill_color    TFT_GREEN
-#define tb_border_color  TFT_DARKGREY
-#define tb_left_margin   25
-#define tb_right_margin  25
-#define tb_bottom_margin 37
-#define tb_width         (TFT_WIDTH - tb_right_margin - tb_left_margin)
-#define tb_height        25
+#define tb_fill_color   TFT_GREEN
+#define tb_border_color TFT_DARKGREY
+#define tb_major_ticks  5
+
+// OTA
+#define ota_error_show_ms 5000  // An OTA error stays on screen this long, or until a button is pressed
+
+// Wake from deep sleep
+#define wifi_resume_timeout_ms 3000  // Give up on the cached WiFi details after 3 seconds and do a cold connect
 
 // RGB LED defines
-#define LED_COUNT 10
-#define LED_PIN   25
+#define LED_COUNT            10
+#define LED_PIN              25
+#define led_frame_ms         40   // 25 frames per second
+#define led_strip_brightness 48   // Global strip brightness (0-255), strip is very bright at full power
+#define led_stats_frames     250  // Report frame cost every 250 frames (10 seconds)
 
-void draw_titlebar();
-void label_touch_buttons();
+void draw_titlebar(const ui_rect& r);
 uint8_t lipo_capacity_percent(float);
 void disp_batt_symbol(uint16_t batt_x, uint16_t batt_y, bool disp_volts);
-void draw_timer_msg(const char* msg);
-void display_pmu_vals();
+void draw_timer_msg(const ui_rect& r);
+void display_pmu_vals(const ui_rect& r);
 uint8_t touch_x_to_percent(uint32_t touch_x);
 void progress_bar(uint8_t percent);
 void bargraph_scale(uint8_t major_ticks, bool scale_type);
-void clear_centre_lcd();
 void myOTA_onStart();
 void myOTA_onProgress(unsigned int progress, unsigned int total);
 void myOTA_onEnd();
 void myOTA_onError(ota_error_t error);
+void ota_screen_restore();
 void display_touch_read(uint8_t gpio_pin);
 void mqtt_callback(char* topic, byte* payload, unsigned int length);
 void reconnect();
+#if MQTT_TLS_MODE
+void tls_bench(uint8_t rounds);
+#endif
 void button_1_click();
 void button_1_longpress();
 void button_2_click();
 void button_2_longpress();
-
-uint32_t iron_timer = timer_duration_sec;  // Initial time is 5 minutes = 300 seconds
-uint16_t button_label_colour;
+void led_update();
+void led_delay(uint32_t ms);
+void draw_main_screen(uint8_t percent);
+void draw_timer_text(const ui_rect& r);
+void paint_battery(const ui_rect& r);
+void paint_startup(const ui_rect& r);
+void paint_bar(const ui_rect& r);
+void paint_scale(const ui_rect& r);
+void paint_ota_title(const ui_rect& r);
+void paint_ota_ip(const ui_rect& r);
+void paint_ota_rssi(const ui_rect& r);
+void paint_ota_percent(const ui_rect& r);
+void paint_ota_status(const ui_rect& r);
+void lcd_erase(const ui_rect& r);
+uint32_t ui_clock_us();
+void ui_refresh();
+void ui_set_bar(uint8_t percent);
+void ui_set_timer_msg(const char* msg);
+void ui_set_startup_msg(const char* msg);
+bool wifi_wait_connected(uint32_t timeout_ms, bool show_dots);
+void save_rtc_snapshot();
+uint32_t rtc_clock_sec();
+void profiles_begin();
+timer_profile& profile_get(uint8_t n);
+timer_profile& cur_profile();
+void profile_apply();
+void profile_select(uint8_t n);
+bool profile_set_field(const char* field, uint32_t value);
+void profiles_flush(bool force);
+void mqtt_command(const char* cmd);
+void binlog_begin();
+void binlog_task(void* param);
+#if BINLOG_BENCH
+void binlog_benchmark();
+#endif
+void bench_begin_scenario();
+void bench_end_scenario();
+void bench_service();
+void bench_publish_unsent();
+void shutdown();
+bool shutdown_publish_off();
+void shutdown_save_state();
+void shutdown_display_off();
+void shutdown_sleep();
+void frame_gov_service();
+void alert_begin();
+void alert_play(const alert_def* def);
+void alert_update();
+void motion_begin();
+void motion_service();
+void net_power_begin();
+void net_listen_interval_apply();
+void net_wifi_event(arduino_event_id_t event, arduino_event_info_t info);
+void net_service();
+void mqtt_state_queue(const char* state);
+bool mqtt_state_flush();
+void mqtt_topic_flush();
+void udp_begin();
+void udp_service();
+void udp_send(const udp_msg& msg, IPAddress ip, uint16_t port);
+void udp_send_status(bool confirmable);
+
+uint32_t iron_timer = default_profiles[0].duration_sec;       // Replaced by the active profile's duration in setup()
+uint32_t timer_start_sec = default_profiles[0].duration_sec;  // Last timer setting chosen by the user, restored after deep sleep
+uint32_t first_frame_ms = 0;                    // Boot to first main screen frame, for measuring resume speed
 uint16_t title_bar_bg_colour = M5.Lcd.color24to16(0x99ddff);
 uint16_t title_bar_txt_colour = M5.Lcd.color24to16(0x262626);
 uint32_t last_iron_time = 0;
+uint32_t dhcp_lease_start_sec = 0;  // RTC clock when the current IP address was leased
+loop_stats loop_timing = {};
+
+// Sound and vibration alerts
+const alert_step alert_click_steps[] = {
+    {ALERT_STEP_VIBRATE, alert_vibration_level, buz_duration},
+    {ALERT_STEP_END, 0, 0},
+};
+const alert_step alert_profile_steps[] = {
+    {ALERT_STEP_TONE, 1320, 60},
+    {ALERT_STEP_PAUSE, 0, 40},
+    {ALERT_STEP_TONE, 1760, 60},
+    {ALERT_STEP_END, 0, 0},
+};
+const alert_step alert_warning_steps[] = {
+    {ALERT_STEP_PCM, 0, alert_chime_ms},
+    {ALERT_STEP_VIBRATE, alert_vibration_level, 200},
+    {ALERT_STEP_PAUSE, 0, 150},
+    {ALERT_STEP_VIBRATE, alert_vibration_level, 200},
+    {ALERT_STEP_END, 0, 0},
+};
+const alert_step alert_final_steps[] = {
+    {ALERT_STEP_TONE, 2000, 100},
+    {ALERT_STEP_PAUSE, 0, 100},
+    {ALERT_STEP_TONE, 2000, 100},
+    {ALERT_STEP_PAUSE, 0, 100},
+    {ALERT_STEP_TONE, 2000, 300},
+    {ALERT_STEP_VIBRATE, 255, 400},
+    {ALERT_STEP_END, 0, 0},
+};
+const alert_def alert_click = {"click", ALERT_PRIO_FEEDBACK, alert_click_steps};
+const alert_def alert_profile = {"profile", ALERT_PRIO_INFO, alert_profile_steps};
+const alert_def alert_warning = {"warning", ALERT_PRIO_WARNING, alert_warning_steps};
+const alert_def alert_final = {"final", ALERT_PRIO_CRITICAL, alert_final_steps};
+
+int8_t alert_chime_pcm[alert_chime_len];  // Filled once by alert_begin()
+alert_queue alerts;
+uint32_t alert_cpu_us = 0;  // CPU time spent starting the steps of the current alert
+uint32_t alert_start_ms = 0;
+
+// Network power policy
+net_window net_win;
+net_stats net_counters;
+uint32_t last_net_report = 0;
+uint32_t net_aligned_ms = 0;
+bool net_aligned = false;
+volatile bool net_listen_check = false;  // Set by the WiFi event task on each association
+net_pub_queue mqtt_state_pending;
+char mqtt_old_cmd_topic[profile_topic_len] = "";  // Command topic to unsubscribe from in the next window, "" = none
+static_assert(profile_topic_len <= net_topic_len, "a profile topic must fit a queued publish");
+
+// Log records waiting to be printed
+binlog_ring binlog_main;
+
+// Energy benchmark
+bench_run bench;
+uint32_t bench_last_sample = 0;
+uint32_t bench_last_action = 0;
+uint8_t bench_step = 0;        // Bar position or OTA progress in the current scenario
+uint8_t bench_brightness = 0;  // Backlight to restore after the screen off scenario
+char bench_unsent[BENCH_COUNT][bench_json_len];  // Reports not yet published, by scenario, "" = none
+
+// Motion detection
+motion_classifier motion;
+uint32_t motion_wakes = 0;    // FIFO reads since the last report
+uint32_t motion_samples = 0;  // Samples classified since the last report
+uint32_t last_motion_report = 0;
+
+// UDP control channel
+WiFiUDP udp;
+IPAddress udp_peer_ip;  // Last peer that sent us a command, status goes to it
+uint16_t udp_peer_port = 0;
+uint16_t udp_next_msg_id = 0;
+uint16_t udp_last_rx_id = 0;  // Duplicate detection for retransmitted commands
+bool udp_rx_any = false;
+udp_pending udp_tx_pending = {};
+uint32_t udp_tx_first_ms = 0;
+uint32_t last_loop_report = 0;
 uint32_t last_display_update = 0;
 
+// Display frame rate and backlight, see frame_governor.h
+frame_governor frame_gov;
+frame_mode frame_shown_mode = FRAME_NORMAL;  // Mode and battery state last applied and logged
+bool frame_shown_low_batt = false;
+uint8_t frame_full_brightness = 0;  // Backlight at start up, dimmed from this on low battery
+uint32_t frame_mode_start = 0;
+uint32_t frame_count = 0;  // Frames painted since the last mode change
+
 // Create sprites
 M5Canvas BattSprite(&M5.Lcd);
 M5Canvas TimerTxtSprite(&M5.Lcd);
 M5Canvas TimerBarSprite(&M5.Lcd);
 
+// Widget tree, one entry per widget in widget_id order
+enum widget_id : uint8_t {
+  W_TITLE = 0,
+  W_BATTERY,
+  W_STARTUP,
+  W_TIMER_MSG,
+  W_TIMER_TEXT,
+  W_OTA_TITLE,
+  W_OTA_IP,
+  W_OTA_RSSI,
+  W_OTA_PERCENT,
+  W_OTA_STATUS,
+  W_PMU,
+  W_BAR,
+  W_SCALE,
+  W_COUNT
+};
+
+ui_widget widgets[W_COUNT] = {
+    {"title", layout::title_bar, draw_titlebar},
+    {"battery", layout::battery, paint_battery},
+    {"startup", layout::startup, paint_startup},
+    {"timer_msg", layout::timer_msg, draw_timer_msg},
+    {"timer_text", layout::timer_text, draw_timer_text},
+    {"ota_title", layout::ota_title, paint_ota_title},
+    {"ota_ip", layout::ota_ip, paint_ota_ip},
+    {"ota_rssi", layout::ota_rssi, paint_ota_rssi},
+    {"ota_percent", layout::ota_percent, paint_ota_percent},
+    {"ota_status", layout::ota_status, paint_ota_status},
+    {"pmu", layout::pmu, display_pmu_vals},
+    {"bar", layout::bar, paint_bar},
+    {"scale", layout::scale, paint_scale},
+};
+ui_tree ui = {widgets, W_COUNT, 0, lcd_erase, ui_clock_us, 0};
+
+// Screens are the set of widgets visible on them
+const uint32_t screen_startup = ui_bit(W_TITLE) | ui_bit(W_BATTERY) | ui_bit(W_STARTUP);
+const uint32_t screen_countdown = ui_bit(W_TITLE) | ui_bit(W_BATTERY) | ui_bit(W_TIMER_MSG) | ui_bit(W_TIMER_TEXT) | ui_bit(W_BAR) | ui_bit(W_SCALE);
+const uint32_t screen_ota = ui_bit(W_TITLE) | ui_bit(W_BATTERY) | ui_bit(W_OTA_TITLE) | ui_bit(W_OTA_IP) | ui_bit(W_OTA_RSSI) | ui_bit(W_OTA_PERCENT) | ui_bit(W_BAR) | ui_bit(W_SCALE);
+const uint32_t screen_ota_done = ui_bit(W_TITLE) | ui_bit(W_BATTERY) | ui_bit(W_OTA_STATUS) | ui_bit(W_BAR) | ui_bit(W_SCALE);
+const uint32_t screen_pmu = ui_bit(W_TITLE) | ui_bit(W_BATTERY) | ui_bit(W_PMU);
+
+// Widget state, change through the ui_set_...() functions so the widget gets invalidated
+const char* startup_msg = "Starting WiFi";
+uint8_t startup_dots = 0;
+const char* timer_msg = time_left_msg;
+uint32_t timer_text_shown = UINT32_MAX;  // Value the timer text widget last painted
+uint8_t bar_percent = 100;
+bool scale_percent = false;  // Bar graph scale in percent (OTA) rather than minutes
+uint8_t ota_percent = 0;
+bool ota_failed = false;
+ota_error_t ota_error_code;
+bool ota_error_shown = false;  // screen_ota_done is up with an error, back to the timer after ota_error_show_ms
+uint32_t ota_error_ms = 0;
+
 // Input pin for the button / active low button / enable internal pull-up resistor
 OneButton button_1 = OneButton(32, true, true);
 OneButton button_2 = OneButton(33, true, true);
 
+// RGB LED strip frame buffer and animation state
+CRGB leds[LED_COUNT];
+uint32_t led_frame = 0;
+uint32_t last_led_frame = 0;
+uint32_t led_frame_us_max = 0;
+uint32_t led_frame_us_total = 0;
+static_assert(sizeof(CRGB) == sizeof(led_rgb), "led_rgb must match CRGB layout");
+
+// Session snapshot, survives deep sleep in RTC slow memory
+RTC_DATA_ATTR rtc_snapshot rtc_snap;
+
+// Timer profiles, read from NVS on first use
+Preferences prefs;
+timer_profile profiles[max_profiles];
+uint8_t profiles_loaded = 0;  // Bit n set = profiles[n] has been read
+uint8_t profiles_dirty = 0;   // Bit n set = profiles[n] needs writing to NVS
+uint8_t active_profile = 0;
+uint8_t stored_active_profile = 0;  // Active profile index as last written to NVS
+uint32_t profile_changed_ms = 0;
+uint32_t profile_msg_until = 0;
+
 /*
   touchCallback()
 
@@ -129,22 +455,35 @@ void touchCallback() {
 }
 
 void button_1_click() {
-  if (iron_timer >= 125)
-    iron_timer -= 120;
-  else
-    iron_timer = 5;
+  if (ota_error_shown) {
+    ota_screen_restore();  // The press only dismisses the error
+    return;
+  }
+  iron_timer = countdown_shorter(iron_timer, cur_profile().step_sec);
+  timer_start_sec = iron_timer;
+  alert_play(&alert_click);
+  udp_send_status(true);
 }
 
 void button_2_click() {
-  iron_timer += 120;
+  if (ota_error_shown) {
+    ota_screen_restore();
+    return;
+  }
+  iron_timer = countdown_longer(iron_timer, cur_profile().step_sec);
+  timer_start_sec = iron_timer;
+  alert_play(&alert_click);
+  udp_send_status(true);
 }
 
 void button_1_longpress() {
-  if (iron_timer >= 5)
-    iron_timer = 5;
+  if (iron_timer >= countdown_min_sec)
+    iron_timer = countdown_min_sec;
 }
 
 void button_2_longpress() {
+  // Cycle through the timer profiles
+  profile_select((active_profile + 1) % max_profiles);
 }
 
 /*
@@ -163,13 +502,38 @@ void setup() {
   cfg.led_brightness = 64;       // default= 0. system LED brightness (0=off / 255=max) (※ not NeoPixel)
   M5.begin();
 
-  draw_titlebar();
+  // Log formatting and printing runs in its own task from here on
+  binlog_begin();
+
+  // Load the active timer profile, the others are read when selected
+  profiles_begin();
+
+  // Resume the last session if woken by the button and the RTC snapshot survived
+  rtc_snapshot_status snap_status = rtc_snapshot_check(&rtc_snap);
+  bool resumed = (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0) && (snap_status == RTC_SNAPSHOT_OK);
+  if (resumed) {
+    // Don't resume a setting that would switch straight back off
+    if (rtc_snap.timer_start_sec > cur_profile().warning_sec)
+      timer_start_sec = rtc_snap.timer_start_sec;
+    iron_timer = timer_start_sec;
+    if (rtc_snap.mqtt_broker < mqtt_broker_list.count)
+      mqtt_broker_list.last_good = rtc_snap.mqtt_broker;
+#if MQTT_TLS_MODE
+    if (wifiClient.session_load(rtc_snap.tls_session, rtc_snap.tls_session_len))
+      tls_session_broker = rtc_snap.mqtt_broker;
+#endif
+  } else if (snap_status != RTC_SNAPSHOT_EMPTY) {
+    blog_w("RTC snapshot discarded, status=%d", snap_status);
+    rtc_snapshot_invalidate(&rtc_snap);
+  }
 
   // Display AXP192 Power Management Values
+  // ui_show(ui, screen_pmu);
   // do {
   //   M5.update();
   //   delay(1000);
-  //   display_pmu_vals();
+  //   ui_invalidate(ui, W_PMU);
+  //   ui_refresh();
   // } while (!M5.BtnA.wasClicked());
 
   // Setup button one button callbacks
@@ -182,55 +546,100 @@ void setup() {
   // esp_sleep_enable_ext1_wakeup(0x300000000, ESP_EXT1_WAKEUP_ALL_LOW); // Wake up when GPIO32 and GPIO33 are pressed together
   esp_sleep_enable_ext0_wakeup(GPIO_NUM_33, 0);
 
+  // RGB LED strip on the M5GO base, FastLED drives it from the RMT peripheral so no SPI bus contention with the LCD
+  FastLED.addLeds<SK6812, LED_PIN, GRB>(leds, LED_COUNT);
+  FastLED.setBrightness(led_strip_brightness);
+
+  // Accelerometer samples are collected in the IMU's FIFO and read in batches
+  motion_begin();
+
+  frame_gov_init(frame_gov, millis());
+  frame_full_brightness = M5.Lcd.getBrightness();
+
+  alert_begin();
+
   // Create sprite for battery symbol
-  BattSprite.createSprite(batt_spr_wdth, batt_spr_ht);
+  BattSprite.createSprite(layout::battery.w, layout::battery.h);
 
   // Create sprite for time remaining mins:secs display
-  TimerTxtSprite.createSprite(time_spr_wdth, time_spr_ht);
+  TimerTxtSprite.createSprite(layout::timer_text.w, layout::timer_text.h);
   TimerTxtSprite.setFont(&fonts::FreeSansBold24pt7b);
   TimerTxtSprite.setTextDatum(top_center);
   TimerTxtSprite.setTextPadding(TimerTxtSprite.textWidth("00:00"));
 
   // Create sprite for time remaining bargraph
-  TimerBarSprite.createSprite(tb_width, tb_height);
-
-  // Display WiFi starting message
-  M5.Lcd.setTextDatum(top_center);
-  M5.Lcd.setFont(&fonts::FreeSans18pt7b);
-  M5.Lcd.setTextColor(TFT_LIGHTGREY, TFT_BLACK);
-  M5.Lcd.drawString("Starting WiFi", time_msg_x, time_msg_y);
+  TimerBarSprite.createSprite(layout::bar.w, layout::bar.h);
+  TimerBarSprite.drawRect(0, 0, layout::bar.w, layout::bar.h, tb_border_color);
 
-  // Set location where "connecting..." dots will appear
-  M5.Lcd.setCursor(110, 120);
-  uint8_t tries_count = 0;
   bool connected = false;
-
-  // Serial.println("Booting");
   WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, password);
-  do {
-    delay(500);
-    M5.Lcd.print(".");
-    tries_count++;
-    connected = (WiFi.status() == WL_CONNECTED);
-  } while (!connected && (tries_count < 10));
-
-  M5.Lcd.setTextPadding(280);
-
-  if (connected) {
-    M5.Lcd.drawString("Connected!", time_msg_x, time_msg_y);
-  } else {
-    // WiFi not connected
-    M5.Lcd.drawString("No WiFi", time_msg_x, time_msg_y);
-    M5.Lcd.sleep();
-    esp_deep_sleep_start();
+
+  if (resumed) {
+    // Paint the timer screen straight away, then connect in the background using the cached network details
+    draw_main_screen(rtc_snap.bar_percent);
+    first_frame_ms = millis();
+    blog_i("Resumed: wake to first frame %u ms (previous boot %u ms)", first_frame_ms, rtc_snap.first_frame_ms);
+
+    // Static IP, channel and BSSID skip DHCP and the channel scan. Once the lease is old it's DHCP on the cached channel
+    bool use_lease = rtc_snapshot_lease_valid(&rtc_snap, rtc_clock_sec());
+    if (use_lease)
+      WiFi.config(IPAddress(rtc_snap.local_ip), IPAddress(rtc_snap.gateway_ip), IPAddress(rtc_snap.subnet_mask), IPAddress(rtc_snap.dns_ip));
+    else
+      blog_i("Cached IP address older than %u s, using DHCP", rtc_lease_max_sec);
+    WiFi.begin(ssid, password, rtc_snap.wifi_channel, rtc_snap.wifi_bssid);
+    connected = wifi_wait_connected(wifi_resume_timeout_ms, false);
+    if (connected)
+      dhcp_lease_start_sec = use_lease ? rtc_snap.lease_start_sec : rtc_clock_sec();
+
+    if (!connected) {
+      // Cached details are stale (e.g. router changed channel), fall back to a cold start connection
+      blog_w("Cached WiFi details failed, doing full connect");
+      rtc_snapshot_invalidate(&rtc_snap);
+      resumed = false;
+      WiFi.disconnect();
+      WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));  // All zero = back to DHCP
+    }
+  }
+
+  if (connected)
+    udp_begin();  // First status datagram goes out straight after association, before MQTT
+
+  if (!resumed) {
+    // Display WiFi starting message, "connecting..." dots appear underneath
+    ui_show(ui, screen_startup);
+    ui_refresh();
+
+    // Serial.println("Booting");
+    WiFi.begin(ssid, password);
+    connected = wifi_wait_connected(5000, true);
+
+    if (connected) {
+      dhcp_lease_start_sec = rtc_clock_sec();
+      ui_set_startup_msg("Connected!");
+      ui_refresh();
+      udp_begin();
+    } else {
+      // WiFi not connected
+      ui_set_startup_msg("No WiFi");
+      ui_refresh();
+      M5.Lcd.sleep();
+      esp_deep_sleep_start();
+    }
   }
 
-  // Start MQTT client
-  mqttClient.setServer(mqttServer, mqttPort);
+  // Radio sleeps between beacons from here on
+  net_power_begin();
+
+  // Start MQTT client, the broker is chosen from mqtt_brokers[] on each connection attempt
   mqttClient.setCallback(mqtt_callback);
-  reconnect();  // Turn on switch if MQTT connected
-  delay(1000); // Give user time to read WiFI Connected message
+  mqttClient.setSocketTimeout(mqtt_socket_timeout_sec);
+  mqttClient.setKeepAlive(mqtt_keepalive_sec);
+#if MQTT_TLS_MODE
+  wifiClient.set_ca_cert(MQTT_CA_CERT);
+  wifiClient.set_handshake_timeout(mqtt_tls_timeout_ms);
+#endif
+  broker_race_init(mqtt_race);
+  reconnect();  // Starts connecting, the switch is turned on from loop() once MQTT is connected
 
   // Setup callbacks for OTA updates
   ArduinoOTA.onStart(myOTA_onStart);
@@ -238,17 +647,19 @@ void setup() {
   ArduinoOTA.onEnd(myOTA_onEnd);
   ArduinoOTA.onError(myOTA_onError);
 
-  clear_centre_lcd();
-  draw_timer_msg(time_left_msg);
-
-  // Display a full progress bar to begin count down timer
-  TimerBarSprite.drawRect(0, 0, tb_width, tb_height, tb_border_color);
-  TimerBarSprite.pushSprite(tb_left_margin, TFT_HEIGHT - tb_height - tb_bottom_margin);
-  progress_bar(100);  // Start timer with a full bar
-  bargraph_scale(5, false);
+  if (!resumed) {
+    delay(1000);  // Give user time to read WiFI Connected message
+    draw_main_screen(100);  // Start timer with a full bar
+    first_frame_ms = millis();
+    blog_i("Cold start: boot to first frame %u ms", first_frame_ms);
+  }
 
   // Start the Over The Air (OTA) object
   ArduinoOTA.begin();
+
+#if BINLOG_BENCH
+  binlog_benchmark();
+#endif
 }
 
 /*
@@ -260,8 +671,7 @@ void loop() {
   uint32_t tx = 0;
   uint32_t ty = 0;
   uint8_t percent = 0;
-  uint16_t iron_seconds = 0;
-  uint16_t iron_minutes = 0;
+  uint32_t loop_start_us = micros();
 
   // Check for WiFi OTA
   ArduinoOTA.handle();
@@ -270,72 +680,420 @@ void loop() {
   if (!mqttClient.connected()) {
     reconnect();
   }
-  mqttClient.loop();
+
+  // MQTT and UDP are serviced together once per radio wake, UDP keeps working while MQTT is down
+  net_service();
+
+#if MQTT_TLS_MODE
+  if (tls_bench_rounds) {
+    tls_bench(tls_bench_rounds);
+    tls_bench_rounds = 0;
+  }
+#endif
+
+  // Moving the appliance means it is still in use
+  motion_service();
+
+  // Start the next alert step, the speaker DMA and motor run on their own
+  alert_update();
+
+  bench_service();
 
   button_1.tick();
   button_2.tick();
 
+  led_update();
+
+  // Write any batched profile changes once they have settled
+  profiles_flush(false);
+
+  // The slider sets the timer straight away, it is repainted at the governor's frame rate
   if (M5.Lcd.getTouch(&tx, &ty)) {
     percent = touch_x_to_percent(tx);
-    progress_bar(percent);
-    iron_timer = (percent * timer_duration_sec) / 100;
-    delay(20);
+    ui_set_bar(percent);
+    iron_timer = countdown_from_percent(percent, cur_profile().duration_sec);
+    timer_start_sec = iron_timer;
+    frame_gov_activity(frame_gov, millis());
   }
 
-  // Do the fast 250 ms updates
-  if (millis() - last_display_update > 250) {
-    last_display_update = millis();
+  // An OTA error is only shown for a while, the timer is still running underneath
+  if (ota_error_shown && millis() - ota_error_ms >= ota_error_show_ms)
+    ota_screen_restore();
 
-    // Do the 1 second updates
-    if (millis() - last_iron_time > 1000) {
-      last_iron_time = millis();
-
-      // Get Core2 battery charge capacity - only need to update this once per second
-      disp_batt_symbol(TFT_WIDTH - batt_spr_wdth, 0, true);
-
-      if (iron_timer > 0) {
-        // Decrement the timer by 1 second
-        iron_timer--;
-
-      } else if (iron_timer == 0) {
-        // MQTT code to turn iron OFF
-        mqttClient.publish(stateTopic, "Off");
-        M5.Lcd.sleep();
-        // Enable interrupt on touch GPIO pin "touch_pin_gpio", when touch read falls below "touch_pin_low_threshold"
-        // Core2 running on LiPo battery (not plugged into USB)
-        //    Not touched:  75
-        //    Touched:      53
-        // Core2 plugged into mac via USB:
-        //    Not touched:  75
-        //    Touched:      20
-        // touchAttachInterrupt(touch_pin_gpio, touchCallback, touch_pin_low_threshold);
-        // esp_sleep_enable_touchpad_wakeup();
-
-        delay(200);  // Give MQTT message time to be sent
-        esp_deep_sleep_start();
-      }
-    }
+  // Do the 1 second updates, the timer counts down by 1 second each time
+  countdown_event event = countdown_step(iron_timer, last_iron_time, millis());
+  if (event != COUNTDOWN_IDLE) {
+    // Get Core2 battery charge capacity - only need to update this once per second
+    ui_invalidate(ui, W_BATTERY);
+
+    if (event == COUNTDOWN_EXPIRED)
+      shutdown();  // Does not return
+
+    // The timer counts down one second per tick, so each alert fires exactly once
+    if (iron_timer == cur_profile().warning_sec)
+      alert_play(&alert_warning);
+    if (iron_timer == alert_final_at(cur_profile().warning_sec))
+      alert_play(&alert_final);
+
+    bool external_power = M5.Power.Axp192.getVBUSVoltage() > 4.0f || M5.Power.Axp192.getACINVolatge() > 4.0f;
+    frame_gov_battery(frame_gov, M5.Power.getBatteryLevel(), external_power);
+  }
+
+  frame_gov_service();
+
+  // Repaint at the governor's frame rate, and straight away when the timer ticks so seconds are never late
+  if (event != COUNTDOWN_IDLE || millis() - last_display_update >= frame_gov_interval_ms(frame_gov)) {
+    last_display_update = millis();
+    frame_count++;
 
     // For development, read touch level and display on LCD
     // display_touch_read(touch_pin_gpio);
 
-    // Update the timer bar graph
-    percent = (iron_timer * 100) / timer_duration_sec;
-    progress_bar(percent);
+    // Update the timer bar graph, unless a benchmark scenario is sweeping it
+    percent = (iron_timer >= cur_profile().duration_sec) ? 100 : (iron_timer * 100) / cur_profile().duration_sec;
+    if (!bench_drives_bar(bench))
+      ui_set_bar(percent);
+
+    // Switch the message above the timer text when about to shut down, or show a newly selected profile
+    if (millis() < profile_msg_until)
+      ui_set_timer_msg(cur_profile().name);
+    else
+      ui_set_timer_msg((iron_timer > cur_profile().warning_sec) ? time_left_msg : switch_off_msg);
 
     // Display the timer mm:ss text
-    if (iron_timer > secs_remain_shutdown_msg)
-      TimerTxtSprite.setTextColor(TFT_YELLOW, timer_txt_bg_color);
-    else if (iron_timer <= secs_remain_shutdown_msg)
-      TimerTxtSprite.setTextColor(TFT_RED, timer_txt_bg_color);
-    iron_seconds = iron_timer % 60;
-    iron_minutes = iron_timer / 60;
-    char txt[50] = "";
-    sprintf(txt, "%2d:%02d", iron_minutes, iron_seconds);
-    // Serial.println(txt);
-    TimerTxtSprite.drawString(txt, time_spr_wdth / 2, 0);
-    // Display the sprite
-    TimerTxtSprite.pushSprite(time_spr_x, time_spr_y);
+    if (iron_timer != timer_text_shown)
+      ui_invalidate(ui, W_TIMER_TEXT);
+
+    // Only the widgets that changed get repainted
+    ui_refresh();
+  }
+
+  // Loop timing, iterations over budget show up as a laggy slider or late shutdown
+  loop_stats_add(loop_timing, micros() - loop_start_us, loop_budget_us);
+  if (millis() - last_loop_report > loop_stats_period) {
+    last_loop_report = millis();
+    blog_d("Loop: %u iterations, avg %u us, max %u us, %u over budget", loop_timing.iterations, loop_stats_avg_us(loop_timing), loop_timing.max_us, loop_timing.over_budget);
+    loop_timing = {};
+  }
+}
+
+/*
+  shutdown()
+
+  Description:
+  ------------
+  * Timer has expired: switch the appliance off, save state and deep sleep
+  * The order is kept by countdown_shutdown(), so the same sequence is soak tested on the host
+*/
+void shutdown() {
+  static const shutdown_steps steps = {shutdown_publish_off, shutdown_save_state, shutdown_display_off, shutdown_sleep};
+  countdown_shutdown(steps);
+}
+
+bool shutdown_publish_off() {
+  // MQTT code to turn iron OFF. It waits for the radio's next wake, at most one listen interval
+  mqtt_state_queue("Off");
+  while (mqttClient.connected() && !net_window_due(net_win, micros()))
+    delay(1);
+  bool sent = mqtt_state_flush();
+  if (!sent)
+    blog_w("Off not sent, MQTT is down");
+  return sent;
+}
+
+void shutdown_save_state() {
+  profiles_flush(true);
+  save_rtc_snapshot();
+}
+
+void shutdown_display_off() {
+  blog_i("Timer expired, shutting down");
+  M5.Lcd.sleep();
+  FastLED.clear(true);
+}
+
+void shutdown_sleep() {
+  // Enable interrupt on touch GPIO pin "touch_pin_gpio", when touch read falls below "touch_pin_low_threshold"
+  // Core2 running on LiPo battery (not plugged into USB)
+  //    Not touched:  75
+  //    Touched:      53
+  // Core2 plugged into mac via USB:
+  //    Not touched:  75
+  //    Touched:      20
+  // touchAttachInterrupt(touch_pin_gpio, touchCallback, touch_pin_low_threshold);
+  // esp_sleep_enable_touchpad_wakeup();
+
+  delay(200);  // Give MQTT message time to be sent, and the log drain task time to finish
+  esp_deep_sleep_start();
+}
+
+/*
+  draw_main_screen()
+
+  Description:
+  ------------
+  * Switch to the count down screen: message, bar graph with scale, and timer text
+
+  Inputs:
+  -------
+  * percent - initial bar graph fill, 0% to 100%
+*/
+void draw_main_screen(uint8_t percent) {
+  ui_set_bar(percent);
+  ui_show(ui, screen_countdown);
+  ui_refresh();
+}
+
+/*
+  ui_refresh()
+
+  Description:
+  ------------
+  * Paint the dirty widgets and log what the frame cost
+*/
+void ui_refresh() {
+  ui_render_stats stats = ui_render(ui);
+  if (stats.painted || stats.erased)
+    blog_d("UI frame: %u painted, %u erased, %u us", stats.painted, stats.erased, stats.us);
+}
+
+/*
+  ui_set_...()
+
+  Description:
+  ------------
+  * Update widget state, only invalidating the widget when the value actually changes
+*/
+void ui_set_bar(uint8_t percent) {
+  if (percent == bar_percent) return;
+  bar_percent = percent;
+  ui_invalidate(ui, W_BAR);
+}
+
+void ui_set_timer_msg(const char* msg) {
+  if (msg == timer_msg) return;
+  timer_msg = msg;
+  ui_invalidate(ui, W_TIMER_MSG);
+}
+
+void ui_set_startup_msg(const char* msg) {
+  if (msg == startup_msg) return;
+  startup_msg = msg;
+  ui_invalidate(ui, W_STARTUP);
+}
+
+uint32_t ui_clock_us() {
+  return micros();
+}
+
+/*
+  lcd_erase()
+
+  Description:
+  ------------
+  * Clear the area of a widget leaving the screen
+*/
+void lcd_erase(const ui_rect& r) {
+  M5.Lcd.fillRect(r.x, r.y, r.w, r.h, TFT_BLACK);
+}
+
+/*
+  paint_startup()
+
+  Description:
+  ------------
+  * WiFi start up message, with a "connecting..." dot for each 500ms waited
+*/
+void paint_startup(const ui_rect& r) {
+  char dots[16] = "";
+  uint8_t dot_count = (startup_dots < sizeof(dots) - 1) ? startup_dots : sizeof(dots) - 1;
+  memset(dots, '.', dot_count);
+
+  M5.Lcd.setFont(&fonts::FreeSans18pt7b);
+  M5.Lcd.setTextColor(TFT_LIGHTGREY, TFT_BLACK);
+  M5.Lcd.setTextDatum(top_center);
+  M5.Lcd.setTextPadding(r.w - 20);
+  M5.Lcd.drawString(startup_msg, r.centre_x(), r.y);
+
+  M5.Lcd.setTextDatum(top_left);
+  M5.Lcd.setTextPadding(0);
+  M5.Lcd.drawString(dots, layout::startup_dots_x, layout::startup_dots_y);
+}
+
+void paint_battery(const ui_rect& r) {
+  disp_batt_symbol(r.x, r.y, true);
+}
+
+/*
+  paint_bar()
+
+  Description:
+  ------------
+  * Bar graph widget. The sprite keeps its contents, so progress_bar() only fills or erases the change
+*/
+void paint_bar(const ui_rect& r) {
+  progress_bar(bar_percent);
+}
+
+void paint_scale(const ui_rect& r) {
+  // Minutes scale is regenerated to suit the active profile's duration
+  if (scale_percent)
+    bargraph_scale(tb_major_ticks, true);
+  else
+    bargraph_scale(profile_scale_ticks(cur_profile().duration_sec), false);
+}
+
+/*
+  draw_timer_text()
+
+  Description:
+  ------------
+  * Display the timer mm:ss text, red when about to switch off
+*/
+void draw_timer_text(const ui_rect& r) {
+  uint16_t iron_seconds = iron_timer % 60;
+  uint16_t iron_minutes = iron_timer / 60;
+
+  if (iron_timer > cur_profile().warning_sec)
+    TimerTxtSprite.setTextColor(TFT_YELLOW, timer_txt_bg_color);
+  else if (iron_timer <= cur_profile().warning_sec)
+    TimerTxtSprite.setTextColor(TFT_RED, timer_txt_bg_color);
+  char txt[50] = "";
+  sprintf(txt, "%2d:%02d", iron_minutes, iron_seconds);
+  blog_v("Timer text %s", txt);
+  TimerTxtSprite.drawString(txt, r.w / 2, 0);
+  // Display the sprite
+  TimerTxtSprite.pushSprite(r.x, r.y);
+  timer_text_shown = iron_timer;
+}
+
+/*
+  wifi_wait_connected()
+
+  Description:
+  ------------
+  * Wait for WiFi.begin() to associate and get an IP address
+
+  Inputs:
+  -------
+  * timeout_ms - give up after this long
+  * show_dots  - print a "connecting..." dot on the LCD every 500ms
+
+  Return:
+  -------
+  * true if connected
+*/
+bool wifi_wait_connected(uint32_t timeout_ms, bool show_dots) {
+  uint32_t start = millis();
+  uint32_t last_dot = start;
+
+  while (WiFi.status() != WL_CONNECTED) {
+    if (millis() - start >= timeout_ms)
+      return false;
+    led_delay(10);
+    if (show_dots && (millis() - last_dot >= 500)) {
+      last_dot = millis();
+      startup_dots++;
+      ui_invalidate(ui, W_STARTUP);
+      ui_refresh();
+    }
+  }
+  return true;
+}
+
+/*
+  save_rtc_snapshot()
+
+  Description:
+  ------------
+  * Save the session to RTC memory just before deep sleep so the next wake can resume
+  * Network details are only cached while WiFi is connected, otherwise the snapshot is cleared
+*/
+void save_rtc_snapshot() {
+  if (!WiFi.isConnected()) {
+    rtc_snapshot_invalidate(&rtc_snap);
+    return;
+  }
+
+  rtc_snap.timer_start_sec = timer_start_sec;
+  rtc_snap.wifi_channel = WiFi.channel();
+  memcpy(rtc_snap.wifi_bssid, WiFi.BSSID(), sizeof(rtc_snap.wifi_bssid));
+  rtc_snap.mqtt_broker = mqtt_broker_list.last_good;
+  rtc_snap.local_ip = WiFi.localIP();
+  rtc_snap.gateway_ip = WiFi.gatewayIP();
+  rtc_snap.subnet_mask = WiFi.subnetMask();
+  rtc_snap.dns_ip = WiFi.dnsIP();
+  rtc_snap.lease_start_sec = dhcp_lease_start_sec;
+#if MQTT_TLS_MODE
+  size_t tls_session_len = 0;
+  if (tls_session_broker == rtc_snap.mqtt_broker && !wifiClient.session_save(rtc_snap.tls_session, sizeof(rtc_snap.tls_session), tls_session_len))
+    blog_w("TLS session not saved, over %u bytes", sizeof(rtc_snap.tls_session));
+  rtc_snap.tls_session_len = tls_session_len;
+#endif
+  rtc_snap.bar_percent = (timer_start_sec >= cur_profile().duration_sec) ? 100 : (timer_start_sec * 100) / cur_profile().duration_sec;
+  rtc_snap.first_frame_ms = first_frame_ms;
+  rtc_snap.boot_count++;
+  rtc_snapshot_seal(&rtc_snap);
+}
+
+// Seconds on the RTC clock, which keeps counting through deep sleep
+uint32_t rtc_clock_sec() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec;
+}
+
+/*
+  led_update()
+
+  Description:
+  ------------
+  * Render and show the next LED strip frame, at most once every led_frame_ms
+  * Never blocks: returns straight away if the next frame is not due yet
+  * Tracks the worst case and average frame cost (render + show) in microseconds
+*/
+void led_update() {
+  led_mode mode = LED_MODE_COUNTDOWN;
+
+  if (millis() - last_led_frame < led_frame_ms)
+    return;
+  last_led_frame = millis();
+
+  uint32_t start_us = micros();
+
+  if (!WiFi.isConnected() || !mqttClient.connected())
+    mode = LED_MODE_CONNECTING;
+  else if (iron_timer <= cur_profile().warning_sec)
+    mode = LED_MODE_WARNING;
+
+  uint8_t percent = (iron_timer >= cur_profile().duration_sec) ? 100 : (iron_timer * 100) / cur_profile().duration_sec;
+  led_anim_frame(reinterpret_cast<led_rgb*>(leds), LED_COUNT, mode, percent, led_frame);
+  FastLED.show();
+  led_frame++;
+
+  uint32_t frame_us = micros() - start_us;
+  led_frame_us_total += frame_us;
+  if (frame_us > led_frame_us_max) led_frame_us_max = frame_us;
+
+  if (led_frame % led_stats_frames == 0) {
+    blog_d("LED frame cost: avg %u us, max %u us", led_frame_us_total / led_stats_frames, led_frame_us_max);
+    led_frame_us_total = 0;
+    led_frame_us_max = 0;
+  }
+}
+
+/*
+  led_delay()
+
+  Description:
+  ------------
+  * Replacement for delay() during start up, keeps the LED animation running while waiting
+*/
+void led_delay(uint32_t ms) {
+  uint32_t start = millis();
+  while (millis() - start < ms) {
+    led_update();
+    delay(5);
   }
 }
 
@@ -361,22 +1119,22 @@ void progress_bar(uint8_t percent) {
 
   // Out of limit checks
   if (percent >= 100)
-    this_x = tb_width - 1;  // Minus 1 so we don't overwrite the RHS of border rectangle
+    this_x = layout::bar.w - 1;  // Minus 1 so we don't overwrite the RHS of border rectangle
   else if (percent == 0)
     this_x = 1;  // Plus 1 so we don't overwrite the LHS of border rectangle
   else
     // Convert percent value into sprite width
-    this_x = (percent * tb_width) / 100;
-  // Serial.printf("this_x = %d, last_spr_x=%d\n", this_x, last_spr_x);
+    this_x = (percent * layout::bar.w) / 100;
+  blog_v("Bar this_x = %u, last_x = %u", this_x, last_x);
 
   if (this_x < last_x) {
     width = last_x - this_x;
-    TimerBarSprite.fillRect(this_x, 1, width, tb_height - 2, TFT_BLACK);  // Erase the unneeded portion of this bar
+    TimerBarSprite.fillRect(this_x, 1, width, layout::bar.h - 2, TFT_BLACK);  // Erase the unneeded portion of this bar
   } else if (this_x > last_x) {
     width = this_x - last_x;
-    TimerBarSprite.fillRect(last_x, 1, width, tb_height - 2, tb_fill_color);
+    TimerBarSprite.fillRect(last_x, 1, width, layout::bar.h - 2, tb_fill_color);
   }
-  TimerBarSprite.pushSprite(tb_left_margin, TFT_HEIGHT - tb_height - tb_bottom_margin);
+  TimerBarSprite.pushSprite(layout::bar.x, layout::bar.y);
   last_x = this_x;
 }
 
@@ -389,15 +1147,13 @@ void progress_bar(uint8_t percent) {
 
   Inputs:
   -------
-  * None
+  * major_ticks - labelled ticks, with a minor tick between each pair
+  * scale_type  - true for percent (OTA), false for minutes of the active profile
 */
 void bargraph_scale(uint8_t major_ticks, bool scale_type) {
-  uint16_t step = 0;
-  uint16_t minor_ticks = major_ticks * 2;
-  uint16_t pix_per_min_tick = (tb_width + 0) / minor_ticks;
-  uint16_t pix_per_maj_tick = 2 * pix_per_min_tick;
-  const uint16_t tick_y = TFT_HEIGHT - tb_bottom_margin + 3;
-  const uint16_t txt_y = TFT_HEIGHT - 1;
+  uint8_t minor_ticks = major_ticks * 2;
+  const uint16_t tick_y = layout::scale.y + 2;
+  const uint16_t txt_y = layout::screen_h - 1;
   char txt[10] = "";
 
   M5.Lcd.setFont(&fonts::FreeSans9pt7b);
@@ -406,21 +1162,22 @@ void bargraph_scale(uint8_t major_ticks, bool scale_type) {
   M5.Lcd.setTextDatum(bottom_center);
 
   // Clear the old scale
-  M5.Lcd.fillRect(tb_left_margin - 20, TFT_HEIGHT - tb_bottom_margin + 1, tb_width + 30, tb_bottom_margin - 2, TFT_BLACK);
-
-  for (step = 0; step <= tb_width; step++) {
-    if (step % pix_per_maj_tick == 0) {
-      M5.Lcd.drawFastVLine(tb_left_margin + step, tick_y, 12, TFT_LIGHTGRAY);
-
-      if (scale_type) {
-        sprintf(txt, "%2d", (step * 100) / tb_width);
-        M5.Lcd.drawString(txt, tb_left_margin + step, txt_y);
-      } else {
-        sprintf(txt, "%d", (step * timer_duration_sec) / (tb_width * 60));
-        M5.Lcd.drawString(txt, tb_left_margin + step, txt_y);
-      }
-    } else if (step % pix_per_min_tick == 0)
-      M5.Lcd.drawFastVLine(tb_left_margin + step, tick_y, 5, TFT_LIGHTGRAY);
+  M5.Lcd.fillRect(layout::scale.x, layout::scale.y, layout::scale.w, layout::scale.h, TFT_BLACK);
+
+  // Every tick is placed from its own index, so the last one lands on the end of the bar
+  for (uint8_t i = 0; i <= minor_ticks; i++) {
+    int16_t x = layout::scale_tick_x(i, minor_ticks);
+
+    if (i % 2 == 0) {
+      M5.Lcd.drawFastVLine(x, tick_y, 12, TFT_LIGHTGRAY);
+
+      if (scale_type)
+        sprintf(txt, "%2d", (i / 2) * 100 / major_ticks);
+      else
+        profile_scale_label(txt, sizeof(txt), cur_profile().duration_sec, i / 2, major_ticks);
+      M5.Lcd.drawString(txt, x, txt_y);
+    } else
+      M5.Lcd.drawFastVLine(x, tick_y, 5, TFT_LIGHTGRAY);
   }
 }
 
@@ -433,7 +1190,7 @@ void bargraph_scale(uint8_t major_ticks, bool scale_type) {
 
   Inputs:
   -------
-  * touch_x - 0 to TFT_WIDTH (320)
+  * touch_x - 0 to layout::screen_w (320)
 
   Return:
   -------
@@ -442,32 +1199,33 @@ void bargraph_scale(uint8_t major_ticks, bool scale_type) {
 uint8_t touch_x_to_percent(uint32_t touch_x) {
   uint8_t percent = 0;
   // Convert touch x-coord into a sprite rectangle fill amount (this_spr_x), i.e. left margin is sprite zero
-  if (touch_x >= (TFT_WIDTH - tb_right_margin))
+  if (touch_x >= layout::bar.right())
     percent = 100;
-  else if (touch_x <= tb_left_margin)
+  else if (touch_x <= layout::bar.x)
     percent = 0;
   else
-    percent = (uint8_t)(((touch_x - tb_left_margin) * 100) / tb_width);
-  // Serial.printf("this_spr_x = %d, last_spr_x=%d\n", this_spr_x, last_spr_x);
+    percent = (uint8_t)(((touch_x - layout::bar.x) * 100) / layout::bar.w);
+  blog_v("Touch x = %u, bar %u%%", touch_x, percent);
   return percent;
 }
 
-void draw_titlebar() {
+void draw_titlebar(const ui_rect& r) {
   // Mix some new colours for the title bar
 
   // Draw title bar
-  M5.Lcd.drawRect(0, 0, TFT_WIDTH, TFT_HEIGHT, title_bar_bg_colour);
-  M5.Lcd.fillRect(0, 0, TFT_WIDTH, title_bar_height, title_bar_bg_colour);
+  M5.Lcd.drawRect(0, 0, layout::screen_w, layout::screen_h, title_bar_bg_colour);
+  M5.Lcd.fillRect(r.x, r.y, r.w, r.h, title_bar_bg_colour);
 
   // Display Title String
   M5.Lcd.setFont(&fonts::FreeSansBold18pt7b);  // &fonts::FreeSerif9pt7b
   M5.Lcd.setTextDatum(top_left);
   M5.Lcd.setTextColor(title_bar_txt_colour);
-  M5.Lcd.drawString(title_str, title_txt_x_offs, title_txt_y_offs);
+  M5.Lcd.setTextPadding(0);
+  M5.Lcd.drawString(title_str, r.x + layout::title_txt_x_offs, r.y + layout::title_txt_y_offs);
 
   // Display software version
   M5.Lcd.setFont(&fonts::Font2);
-  M5.Lcd.drawString(sw_version, 5, 15);
+  M5.Lcd.drawString(sw_version, r.x + layout::version_x, r.y + layout::version_y);
 }
 
 /*
@@ -502,6 +1260,7 @@ void disp_batt_symbol(uint16_t batt_x, uint16_t batt_y, bool disp_volts) {
   uint16_t fill_colour = TFT_MAGENTA;
   uint16_t outline_colour = TFT_BLACK;
   uint16_t spr_x_offs = 9;  // X-axis offset of battery icon and voltage text in sprite
+  const int16_t batt_spr_ht = layout::battery.h;
   const uint16_t erase_fill_colour = title_bar_bg_colour;
 
   // Clear the old values
@@ -568,35 +1327,14 @@ void disp_batt_symbol(uint16_t batt_x, uint16_t batt_y, bool disp_volts) {
 
   Inputs:
   -------
-  * msg - pointer to string containing message
+  * r - widget rectangle, message is centred along its top edge
 */
-void draw_timer_msg(const char* msg) {
+void draw_timer_msg(const ui_rect& r) {
   M5.Lcd.setFont(&fonts::FreeSansBold18pt7b);
   M5.Lcd.setTextDatum(top_center);
   M5.Lcd.setTextColor(TFT_LIGHTGREY, time_msg_bg_color);
-  M5.Lcd.setTextPadding(TFT_WIDTH - 20);
-  M5.Lcd.drawString(msg, time_msg_x, time_msg_y);
-}
-
-/*
-  label_touch_buttons()
-
-  Description:
-  ------------
-  * Labels the three Core2 touch buttons below the main LCD with triangle pointers
-
-  Inputs:
-  -------
-  * None
-*/
-void label_touch_buttons() {
-  button_label_colour = title_bar_bg_colour;
-  M5.Lcd.fillTriangle(BtnA_x - (Btn_tri_width / 2), Btn_tri_ht, BtnA_x + (Btn_tri_width / 2), Btn_tri_ht, BtnA_x, TFT_HEIGHT - 5, button_label_colour);
-  M5.Lcd.fillTriangle(BtnC_x - (Btn_tri_width / 2), Btn_tri_ht, BtnC_x + (Btn_tri_width / 2), Btn_tri_ht, BtnC_x, TFT_HEIGHT - 5, button_label_colour);
-  M5.Lcd.setFont(&fonts::FreeSans12pt7b);
-  M5.Lcd.setTextColor(TFT_DARKGREY, TFT_BLACK);
-  M5.Lcd.drawString("+60", BtnA_x - 25, Btn_tri_ht - 25);
-  M5.Lcd.drawString("Off", BtnC_x - 16, Btn_tri_ht - 25);
+  M5.Lcd.setTextPadding(r.w);
+  M5.Lcd.drawString(timer_msg, r.centre_x(), r.y);
 }
 
 /*
@@ -608,18 +1346,18 @@ void label_touch_buttons() {
 
   Inputs:
   -------
-  * None
+  * r - widget rectangle, drawn with a yellow border
 */
-void display_pmu_vals() {
+void display_pmu_vals(const ui_rect& r) {
   char txt[40] = "";
   M5.Lcd.setFont(&fonts::FreeSans9pt7b);
   M5.Lcd.setTextColor(TFT_WHITE, TFT_BLUE);
   M5.Lcd.setTextPadding(M5.Lcd.textWidth("VBusCurrent = 00.0mA"));
   M5.Lcd.setTextDatum(top_left);
-  M5.Lcd.drawRect(0, 50, 200, TFT_HEIGHT - 55, TFT_YELLOW);
+  M5.Lcd.drawRect(r.x, r.y, r.w, r.h, TFT_YELLOW);
 
-  uint16_t xpos = 6;
-  uint16_t ypos = 55;
+  uint16_t xpos = r.x + 6;
+  uint16_t ypos = r.y + 5;
   const uint16_t font_ht = 22;
 
   // Note: isCharging() referred to wrong bit, should be 0x04, not 0x02
@@ -654,11 +1392,6 @@ void display_pmu_vals() {
   ypos += font_ht;
 }
 
-void clear_centre_lcd() {
-  // Clear the main central part of the LCD below title bar, and above bar graph
-  M5.Lcd.fillRect(2, title_bar_height + 1, TFT_WIDTH - 4, TFT_HEIGHT - tb_height - tb_bottom_margin - title_bar_height - 5, TFT_BLACK);
-}
-
 /*
   myOTA_onStart()
 
@@ -667,30 +1400,19 @@ void clear_centre_lcd() {
   * Callback function for start of OTA update
 */
 void myOTA_onStart() {
-  String type;
-  if (ArduinoOTA.getCommand() == U_FLASH)
-    type = "sketch";
-  else  // U_SPIFFS
-    type = "filesystem";
   // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
-  // Serial.println("Start updating " + type);
-
-  // Display updating OTA message on LCD
-  clear_centre_lcd();
-  bargraph_scale(5, true);
-  M5.Lcd.setFont(&fonts::FreeSansBold18pt7b);
-  M5.Lcd.setTextDatum(top_center);
-  M5.Lcd.setTextColor(TFT_LIGHTGRAY, TFT_BLACK);
-  M5.Lcd.drawString("Updating OTA", TFT_WIDTH / 2, title_bar_height + 15);
-
-  // Display the ESP32's IP address
-  char txt[40] = "";
-  M5.Lcd.setFont(&fonts::FreeSans9pt7b);
-  M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-  M5.Lcd.setTextDatum(top_left);
-  uint16_t ypos = title_bar_height + 15 + 50;
-  sprintf(txt, "IP: %s", WiFi.localIP().toString().c_str());
-  M5.Lcd.drawString(txt, 20, ypos);
+  blog_i("OTA start updating %s", (ArduinoOTA.getCommand() == U_FLASH) ? "sketch" : "filesystem");
+
+  // Modem sleep would hold every packet of the upload until the next beacon
+  WiFi.setSleep(WIFI_PS_NONE);
+
+  // Switch to the OTA screen, the bar graph now shows percent uploaded
+  scale_percent = true;
+  ota_percent = 0;
+  ui_invalidate(ui, W_SCALE);
+  ui_show(ui, screen_ota);
+  ui_refresh();
+  frame_gov_activity(frame_gov, millis());
 }
 
 /*
@@ -702,27 +1424,20 @@ void myOTA_onStart() {
 */
 void myOTA_onProgress(unsigned int progress, unsigned int total) {
   uint8_t percent = (uint8_t)((progress * 100) / total);
-  char txt[40];
-
-  // Display the ESP32's WiFi signal strength
-  M5.Lcd.setTextDatum(top_left);
-  M5.Lcd.setFont(&fonts::FreeSans9pt7b);
-  M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-  M5.Lcd.setTextPadding(120);
-  uint16_t ypos = title_bar_height + 15 + 50;
-  sprintf(txt, "RSSI: %2d dB", WiFi.RSSI());
-  M5.Lcd.drawString(txt, 190, ypos);
 
-  // Display percent done
-  M5.Lcd.setTextDatum(top_center);
-  M5.Lcd.setFont(&fonts::FreeSansBold18pt7b);
-  M5.Lcd.setTextColor(TFT_YELLOW, TFT_BLACK);
-  M5.Lcd.setTextPadding(80);
-  sprintf(txt, "%2d%%", percent);
-  M5.Lcd.drawString(txt, TFT_WIDTH / 2, TFT_HEIGHT - 100);
+  if (percent != ota_percent) {
+    ota_percent = percent;
+    ui_invalidate(ui, W_OTA_PERCENT);
+    ui_invalidate(ui, W_OTA_RSSI);
+  }
 
-  // Display OTA progress bar
-  progress_bar(percent);
+  // Display OTA progress bar, at the governor's fast frame rate
+  ui_set_bar(percent);
+  frame_gov_activity(frame_gov, millis());
+  if (millis() - last_display_update >= frame_gov_interval_ms(frame_gov)) {
+    last_display_update = millis();
+    ui_refresh();
+  }
 }
 
 /*
@@ -733,12 +1448,11 @@ void myOTA_onProgress(unsigned int progress, unsigned int total) {
   * Callback for end of WiFI OTA upload
 */
 void myOTA_onEnd() {
-  // Serial.println("\nEnd");
-  clear_centre_lcd();
-  M5.Lcd.setFont(&fonts::FreeSansBold18pt7b);
-  M5.Lcd.setTextColor(TFT_LIGHTGRAY, TFT_BLACK);
-  M5.Lcd.drawString("Finished OTA!", TFT_WIDTH / 2, title_bar_height + 40);
-  M5.Lcd.drawString("Rebooting...", TFT_WIDTH / 2, title_bar_height + 80);
+  blog_i("OTA end");
+  ota_failed = false;
+  ui_invalidate(ui, W_OTA_STATUS);
+  ui_show(ui, screen_ota_done);
+  ui_refresh();
 }
 
 /*
@@ -749,41 +1463,130 @@ void myOTA_onEnd() {
   * Callback for error during WiFI OTA upload
 */
 void myOTA_onError(ota_error_t error) {
-  char txt[40] = "";
-  uint16_t ypos = title_bar_height + 15;
-  uint16_t xpos = 50;
+  blog_e("OTA error[%u]", error);
+  WiFi.setSleep(net_ps_mode);
+  ota_failed = true;
+  ota_error_code = error;
+  ota_error_shown = true;
+  ota_error_ms = millis();
+  ui_invalidate(ui, W_OTA_STATUS);
+  ui_show(ui, screen_ota_done);
+  ui_refresh();
+}
 
-  // Prepare LCD for error display
-  clear_centre_lcd();
-  M5.Lcd.setTextPadding(0);
-  M5.Lcd.setFont(&fonts::FreeSans12pt7b);
-  M5.Lcd.setTextDatum(top_center);
-  M5.Lcd.setTextColor(TFT_YELLOW, TFT_BLACK);
-  M5.Lcd.drawString("WiFi OTA Error", TFT_WIDTH / 2, ypos);
+/*
+  ota_screen_restore()
 
-  ypos += 30;
-  M5.Lcd.setTextDatum(top_left);
+  Description:
+  ------------
+  * Leave the OTA screens for the count down screen, with the bar graph scale back in minutes
+*/
+void ota_screen_restore() {
+  ota_error_shown = false;
+  scale_percent = false;
+  ui_invalidate(ui, W_SCALE);
+  draw_main_screen((iron_timer >= cur_profile().duration_sec) ? 100 : (iron_timer * 100) / cur_profile().duration_sec);
+}
 
-  M5.Lcd.setTextColor(TFT_RED, TFT_BLACK);
-  sprintf(txt, "Error[%u]:", error);
-  M5.Lcd.drawString(txt, xpos, ypos);
-  // Serial.printf("Error[%u]: ", error);
-  xpos += 100;
+/*
+  paint_ota_...()
 
-  M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
-  if (error == OTA_AUTH_ERROR) {
-    // Serial.println("Auth Failed");
-    M5.Lcd.drawString("Auth Failed", xpos, ypos);
-  } else if (error == OTA_BEGIN_ERROR) {
-    // Serial.println("Begin Failed");
-    M5.Lcd.drawString("Begin Failed", xpos, ypos);
-  } else if (error == OTA_CONNECT_ERROR) {
+  Description:
+  ------------
+  * Widgets for the OTA update screen
+*/
+void paint_ota_title(const ui_rect& r) {
+  M5.Lcd.setFont(&fonts::FreeSansBold18pt7b);
+  M5.Lcd.setTextDatum(top_center);
+  M5.Lcd.setTextColor(TFT_LIGHTGRAY, TFT_BLACK);
+  M5.Lcd.setTextPadding(r.w);
+  M5.Lcd.drawString("Updating OTA", r.centre_x(), r.y);
+}
+
+void paint_ota_ip(const ui_rect& r) {
+  // Display the ESP32's IP address
+  char txt[40] = "";
+  M5.Lcd.setFont(&fonts::FreeSans9pt7b);
+  M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
+  M5.Lcd.setTextDatum(top_left);
+  M5.Lcd.setTextPadding(r.w);
+  sprintf(txt, "IP: %s", WiFi.localIP().toString().c_str());
+  M5.Lcd.drawString(txt, r.x, r.y);
+}
+
+void paint_ota_rssi(const ui_rect& r) {
+  // Display the ESP32's WiFi signal strength
+  char txt[40] = "";
+  M5.Lcd.setTextDatum(top_left);
+  M5.Lcd.setFont(&fonts::FreeSans9pt7b);
+  M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
+  M5.Lcd.setTextPadding(r.w);
+  sprintf(txt, "RSSI: %2d dB", WiFi.RSSI());
+  M5.Lcd.drawString(txt, r.x, r.y);
+}
+
+void paint_ota_percent(const ui_rect& r) {
+  // Display percent done
+  char txt[40] = "";
+  M5.Lcd.setTextDatum(top_center);
+  M5.Lcd.setFont(&fonts::FreeSansBold18pt7b);
+  M5.Lcd.setTextColor(TFT_YELLOW, TFT_BLACK);
+  M5.Lcd.setTextPadding(r.w);
+  sprintf(txt, "%2d%%", ota_percent);
+  M5.Lcd.drawString(txt, r.centre_x(), r.y);
+}
+
+/*
+  paint_ota_status()
+
+  Description:
+  ------------
+  * End of OTA: either finished and rebooting, or the error reason
+*/
+void paint_ota_status(const ui_rect& r) {
+  char txt[40] = "";
+  uint16_t ypos = r.y;
+  uint16_t xpos = r.x + 40;
+
+  M5.Lcd.fillRect(r.x, r.y, r.w, r.h, TFT_BLACK);
+  M5.Lcd.setTextPadding(0);
+
+  if (!ota_failed) {
+    M5.Lcd.setFont(&fonts::FreeSansBold18pt7b);
+    M5.Lcd.setTextDatum(top_center);
+    M5.Lcd.setTextColor(TFT_LIGHTGRAY, TFT_BLACK);
+    M5.Lcd.drawString("Finished OTA!", r.centre_x(), ypos + 25);
+    M5.Lcd.drawString("Rebooting...", r.centre_x(), ypos + 65);
+    return;
+  }
+
+  M5.Lcd.setFont(&fonts::FreeSans12pt7b);
+  M5.Lcd.setTextDatum(top_center);
+  M5.Lcd.setTextColor(TFT_YELLOW, TFT_BLACK);
+  M5.Lcd.drawString("WiFi OTA Error", r.centre_x(), ypos);
+
+  ypos += 30;
+  M5.Lcd.setTextDatum(top_left);
+
+  M5.Lcd.setTextColor(TFT_RED, TFT_BLACK);
+  sprintf(txt, "Error[%u]:", ota_error_code);
+  M5.Lcd.drawString(txt, xpos, ypos);
+  xpos += 100;
+
+  M5.Lcd.setTextColor(TFT_GREEN, TFT_BLACK);
+  if (ota_error_code == OTA_AUTH_ERROR) {
+    // Serial.println("Auth Failed");
+    M5.Lcd.drawString("Auth Failed", xpos, ypos);
+  } else if (ota_error_code == OTA_BEGIN_ERROR) {
+    // Serial.println("Begin Failed");
+    M5.Lcd.drawString("Begin Failed", xpos, ypos);
+  } else if (ota_error_code == OTA_CONNECT_ERROR) {
     // Serial.println("Connect Failed");
     M5.Lcd.drawString("Connect Failed", xpos, ypos);
-  } else if (error == OTA_RECEIVE_ERROR) {
+  } else if (ota_error_code == OTA_RECEIVE_ERROR) {
     // Serial.println("Receive Failed");
     M5.Lcd.drawString("Receive Failed", xpos, ypos);
-  } else if (error == OTA_END_ERROR) {
+  } else if (ota_error_code == OTA_END_ERROR) {
     // Serial.println("End Failed");
     M5.Lcd.drawString("End Failed", xpos, ypos);
   }
@@ -811,13 +1614,13 @@ void display_touch_read(uint8_t gpio_pin) {
 }
 
 void mqtt_callback(char* topic, byte* payload, unsigned int length) {
-  Serial.print("MQTT message arrived [");
-  Serial.print(topic);
-  Serial.print("] ");
-  for (int i = 0; i < length; i++) {
-    Serial.print((char)payload[i]);
-  }
-  Serial.println();
+  // Text commands, e.g. "profile 2", "set duration 600"
+  char cmd[48] = "";
+  unsigned int cmd_len = (length < sizeof(cmd) - 1) ? length : sizeof(cmd) - 1;
+  memcpy(cmd, payload, cmd_len);
+  blog_i("MQTT message arrived [%s] %s", topic, cmd);
+  net_counters.packets++;
+  mqtt_command(cmd);
 
   // Switch on the LED if an 1 was received as first character
   if ((char)payload[0] == '1') {
@@ -830,33 +1633,1050 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
 }
 
 /*
-  reconnect()
+  frame_gov_service()
+
+  Description:
+  ------------
+  * Let the frame governor step down after activity, then apply and log any change of
+    frame rate or backlight, with the frames painted in the previous mode
+*/
+void frame_gov_service() {
+  frame_gov_update(frame_gov, millis());
+  if (frame_gov.mode == frame_shown_mode && frame_gov.low_batt == frame_shown_low_batt)
+    return;
+
+  if (frame_gov.low_batt != frame_shown_low_batt)
+    M5.Lcd.setBrightness(frame_gov_brightness(frame_gov, frame_full_brightness));
+
+  blog_i("Frame rate: %s -> %s%s, %u ms interval, backlight %u, %u frames in %u ms", frame_mode_names[frame_shown_mode], frame_mode_names[frame_gov.mode],
+         frame_gov.low_batt ? " (low battery)" : "", frame_gov_interval_ms(frame_gov), frame_gov_brightness(frame_gov, frame_full_brightness), frame_count, millis() - frame_mode_start);
+  frame_shown_mode = frame_gov.mode;
+  frame_shown_low_batt = frame_gov.low_batt;
+  frame_mode_start = millis();
+  frame_count = 0;
+}
+
+/*
+  alert_begin()
+
+  Description:
+  ------------
+  * Precompute the PCM clips and set the speaker volume of each priority channel,
+    so warnings are louder than feedback
+*/
+void alert_begin() {
+  alert_pcm_chime(alert_chime_pcm, alert_chime_len, 880, 660);
+
+  M5.Speaker.setVolume(alert_volume);
+  M5.Speaker.setChannelVolume(ALERT_PRIO_FEEDBACK, 128);
+  M5.Speaker.setChannelVolume(ALERT_PRIO_INFO, 160);
+  M5.Speaker.setChannelVolume(ALERT_PRIO_WARNING, 255);
+  M5.Speaker.setChannelVolume(ALERT_PRIO_CRITICAL, 255);
+}
+
+/*
+  alert_play()
+
+  Description:
+  ------------
+  * Queue an alert, see alert_push() for how priorities interact
+*/
+void alert_play(const alert_def* def) {
+  if (alert_push(alerts, def)) {
+    M5.Speaker.stop();
+    M5.Power.setVibration(0);
+    alert_cpu_us = 0;
+  }
+}
+
+/*
+  alert_update()
+
+  Description:
+  ------------
+  * Start the next step of the playing alert when the current one is done
+  * Tones and clips are handed to the speaker's I2S DMA and return straight away,
+    so the cost per alert is only the few calls to start each step
+*/
+void alert_update() {
+  alert_step step;
+  const alert_def* finished;
+  alert_action action = alert_service(alerts, millis(), step, finished);
+
+  if (finished) {
+    blog_d("Alert %s: %u ms, %u us CPU", finished->name, millis() - alert_start_ms, alert_cpu_us);
+    alert_cpu_us = 0;
+  }
+  if (action == ALERT_ACT_IDLE) {
+    M5.Power.setVibration(0);
+    return;
+  }
+  if (action != ALERT_ACT_STEP)
+    return;
+
+  uint32_t start_us = micros();
+  uint8_t channel = alerts.current->prio;
+
+  if (alerts.step == 0)
+    alert_start_ms = millis();
+
+  M5.Power.setVibration(step.kind == ALERT_STEP_VIBRATE ? step.arg : 0);
+  switch (step.kind) {
+    case ALERT_STEP_TONE:
+      M5.Speaker.tone(step.arg, step.duration_ms, channel);
+      break;
+    case ALERT_STEP_PCM:
+      M5.Speaker.playRaw(alert_chime_pcm, alert_chime_len, alert_pcm_rate, false, 1, channel);
+      break;
+    default:
+      break;
+  }
+  alert_cpu_us += micros() - start_us;
+}
+
+/*
+  motion_begin()
+
+  Description:
+  ------------
+  * Set the MPU6886 to sample the accelerometer at 50Hz into its 1kB FIFO, so the
+    CPU only has to wake every motion_read_ms to read a batch
+*/
+void motion_begin() {
+  if (!motion_enabled || !M5.Imu.isEnabled()) return;
+
+  motion_init(motion, imu_counts_per_g);
+  M5.In_I2C.writeRegister8(imu_i2c_addr, imu_reg_smplrt_div, imu_sample_rate_div, imu_i2c_freq);
+  M5.In_I2C.writeRegister8(imu_i2c_addr, imu_reg_config, 0x01, imu_i2c_freq);     // FIFO overwrites oldest when full, DLPF on
+  M5.In_I2C.writeRegister8(imu_i2c_addr, imu_reg_fifo_en, 0x08, imu_i2c_freq);    // Accelerometer into FIFO
+  M5.In_I2C.writeRegister8(imu_i2c_addr, imu_reg_user_ctrl, 0x44, imu_i2c_freq);  // Enable and reset FIFO
+  motion.last_read_ms = millis();
+}
+
+/*
+  motion_service()
+
+  Description:
+  ------------
+  * Every motion_read_ms, read the batch of samples waiting in the IMU FIFO and classify it
+  * Motion keeps the timer from running down below one step of the active profile
+*/
+void motion_service() {
+  uint8_t buf[imu_fifo_max_frames * imu_fifo_frame_len];
+  accel_sample samples[imu_fifo_max_frames];
+  uint8_t count_buf[2];
+
+  if (!motion_enabled || !M5.Imu.isEnabled()) return;
+  if (!motion_read_due(motion, millis())) return;
+  motion_wakes++;
+
+  if (!M5.In_I2C.readRegister(imu_i2c_addr, imu_reg_fifo_count, count_buf, 2, imu_i2c_freq))
+    return;
+  uint16_t frames = ((count_buf[0] << 8) | count_buf[1]) / imu_fifo_frame_len;
+
+  if (frames > imu_fifo_max_frames) {
+    // Fell behind (e.g. blocked by OTA), drop the backlog rather than classify stale data
+    M5.In_I2C.writeRegister8(imu_i2c_addr, imu_reg_user_ctrl, 0x44, imu_i2c_freq);
+    return;
+  }
+  if (frames == 0 || !M5.In_I2C.readRegister(imu_i2c_addr, imu_reg_fifo_rw, buf, frames * imu_fifo_frame_len, imu_i2c_freq))
+    return;
+
+  for (uint16_t i = 0; i < frames; i++) {
+    const uint8_t* f = buf + i * imu_fifo_frame_len;
+    samples[i] = {(int16_t)((f[0] << 8) | f[1]), (int16_t)((f[2] << 8) | f[3]), (int16_t)((f[4] << 8) | f[5])};
+  }
+  motion_samples += frames;
+
+  if (motion_feed(motion, samples, frames, millis()) && iron_timer < cur_profile().step_sec) {
+    iron_timer = cur_profile().step_sec;
+    blog_i("Motion detected, timer extended to %us", iron_timer);
+    udp_send_status(true);
+  }
+
+  if (millis() - last_motion_report > motion_stats_ms) {
+    last_motion_report = millis();
+    blog_d("Motion: %u FIFO wakes, %u samples in the last minute", motion_wakes, motion_samples);
+    motion_wakes = 0;
+    motion_samples = 0;
+  }
+}
+
+/*
+  net_power_begin()
+
+  Description:
+  ------------
+  * Switch the radio to modem sleep and line the service windows up with its wakes
+*/
+void net_power_begin() {
+  WiFi.setSleep(net_ps_mode);
+  net_listen_interval_apply();
+  WiFi.onEvent(net_wifi_event, ARDUINO_EVENT_WIFI_STA_CONNECTED);
+  net_window_init(net_win, net_power_save ? net_listen_interval : 0, micros());  // 0 = every loop() as before
+  last_net_report = millis();
+}
+
+/*
+  net_listen_interval_apply()
+
+  Description:
+  ------------
+  * WiFi.begin(), and the Arduino auto reconnect, leave sta.listen_interval at 0, which
+    ESP-IDF takes as 3. Set net_listen_interval instead
+  * The AP is told the interval when the station associates, so a change only counts
+    after reassociating. With the default of 3 that never happens, so a resume from deep
+    sleep pays nothing for it
+*/
+void net_listen_interval_apply() {
+  wifi_config_t conf;
+  if (esp_wifi_get_config(WIFI_IF_STA, &conf) != ESP_OK)
+    return;
+  uint16_t associated = conf.sta.listen_interval ? conf.sta.listen_interval : 3;
+  if (associated == net_listen_interval)
+    return;
+
+  conf.sta.listen_interval = net_listen_interval;
+  if (esp_wifi_set_config(WIFI_IF_STA, &conf) != ESP_OK) {
+    blog_w("Listen interval %u not set", net_listen_interval);
+    return;
+  }
+  if (WiFi.isConnected()) {
+    blog_i("Listen interval %u -> %u, reassociating", associated, net_listen_interval);
+    net_aligned = false;
+    esp_wifi_disconnect();
+    esp_wifi_connect();
+  }
+}
+
+/*
+  net_wifi_event()
+
+  Description:
+  ------------
+  * Runs on the WiFi event task after each association, so loop() checks the listen
+    interval again and realigns the windows
+*/
+void net_wifi_event(arduino_event_id_t event, arduino_event_info_t info) {
+  net_listen_check = true;
+}
+
+/*
+  net_service()
+
+  Description:
+  ------------
+  * Once per window run the MQTT client (receive, and the keepalive ping when due), send
+    the queued state publishes, and run the UDP channel (receive, then send anything
+    queued since the last window)
+  * The windows are realigned with the AP's TSF every net_align_ms, so each one opens
+    just after a radio wake
+  * Commands wait at most one window longer than the radio already holds them, so the
+    window costs little extra latency and saves waking the radio between beacons
+  * Every net_stats_ms log the estimated radio on time and the measured round trip
+    of UDP status messages, to compare listen intervals
+*/
+void net_service() {
+  if (net_listen_check) {
+    net_listen_check = false;
+    net_aligned = false;
+    net_listen_interval_apply();
+  }
+
+  // The TSF is 0 until the first beacon after associating, keep trying until then
+  if (net_power_save && (!net_aligned || millis() - net_aligned_ms > net_align_ms)) {
+    net_aligned = net_window_align(net_win, esp_wifi_get_tsf_time(WIFI_IF_STA), micros());
+    net_aligned_ms = millis();
+  }
+
+  if (!net_window_due(net_win, micros()))
+    return;
+  net_counters.windows++;
+
+  mqttClient.loop();
+  mqtt_state_flush();
+  mqtt_topic_flush();
+  udp_service();
+
+  uint32_t elapsed = millis() - last_net_report;
+  if (elapsed > net_stats_ms) {
+    // Two packets per keepalive, PINGREQ and PINGRESP
+    uint32_t packets = net_counters.packets + 2 * (elapsed / (mqtt_keepalive_sec * 1000));
+    uint32_t radio_ms = net_radio_on_ms(elapsed, net_power_save ? net_listen_interval : 1, packets);
+    blog_i("Net: %u windows, %u packets, radio on ~%u ms of %u ms, UDP RTT avg %u ms max %u ms", net_counters.windows, packets, radio_ms, elapsed,
+           net_counters.rtt_count ? net_counters.rtt_total_ms / net_counters.rtt_count : 0, net_counters.rtt_max_ms);
+    net_counters = {};
+    last_net_report = millis();
+  }
+}
+
+/*
+  mqtt_state_queue()
+
+  Description:
+  ------------
+  * Queue a publish on the current stateTopic for the next window. The topic is copied,
+    so an "Off" still goes to the old appliance after a profile change
+  * "Off" is never dropped. If the queue is full of them they are sent straight away,
+    without waiting for the window
+
+  Inputs:
+  -------
+  * state - "On" or "Off", a string literal
+*/
+void mqtt_state_queue(const char* state) {
+  bool keep = (strcmp(state, "Off") == 0);
+  if (net_pub_push(mqtt_state_pending, stateTopic, state, keep))
+    return;
+  mqtt_state_flush();
+  if (!net_pub_push(mqtt_state_pending, stateTopic, state, keep))
+    blog_w("MQTT down, %s to %s not queued", state, stateTopic);
+}
+
+/*
+  mqtt_state_flush()
+
+  Description:
+  ------------
+  * Publish the queued states, in order. Called in a window, while the radio is awake.
+    While MQTT is down they stay queued, reconnect() queues "On" anyway
+
+  Return:
+  -------
+  * true if everything queued was sent
+*/
+bool mqtt_state_flush() {
+  while (mqtt_state_pending.count && mqttClient.publish(mqtt_state_pending.msgs[0].topic, mqtt_state_pending.msgs[0].payload)) {
+    net_pub_pop(mqtt_state_pending);
+    net_counters.packets++;
+  }
+  return mqtt_state_pending.count == 0;
+}
+
+/*
+  mqtt_topic_flush()
+
+  Description:
+  ------------
+  * Move the subscription to the current commandTopic after a profile change. Called in
+    a window, like mqtt_state_flush(). While MQTT is down there is nothing to move,
+    reconnect() subscribes to commandTopic on the new session
+*/
+void mqtt_topic_flush() {
+  if (!mqtt_old_cmd_topic[0] || !mqttClient.connected())
+    return;
+
+  // Switched away and back again before the window, still subscribed to the right one
+  if (strcmp(mqtt_old_cmd_topic, commandTopic) != 0) {
+    mqttClient.unsubscribe(mqtt_old_cmd_topic);
+    mqttClient.subscribe(commandTopic);
+    net_counters.packets += 2;
+  }
+  mqtt_old_cmd_topic[0] = '\0';
+}
+
+/*
+  udp_begin()
+
+  Description:
+  ------------
+  * Start listening for UDP commands and broadcast our status so peers learn the address
+*/
+void udp_begin() {
+  if (!udp_enabled) return;
+  udp.begin(udp_port);
+  udp_next_msg_id = (uint16_t)random(0xffff);
+  udp_send_status(false);
+}
+
+/*
+  udp_send()
+
+  Description:
+  ------------
+  * Encode and send one datagram
+*/
+void udp_send(const udp_msg& msg, IPAddress ip, uint16_t port) {
+  uint8_t buf[udp_header_len + udp_max_payload];
+  uint16_t len = udp_encode(msg, buf, sizeof(buf));
+
+  udp.beginPacket(ip, port);
+  udp.write(buf, len);
+  udp.endPacket();
+  net_counters.packets++;
+}
+
+/*
+  udp_send_status()
 
   Description:
   ------------
-  * Reconnect connection with MQTT broker
+  * Send the timer state. Confirmable status goes to the last peer and is retransmitted
+    until ACKed, otherwise it is broadcast once
 
+  Inputs:
+  -------
+  * confirmable - true to use CON, needs a known peer
+*/
+void udp_send_status(bool confirmable) {
+  if (!udp_enabled) return;
+
+  udp_msg msg = {};
+  msg.code = UDP_CODE_STATUS;
+  msg.msg_id = udp_next_msg_id++;
+  msg.timer_sec = (iron_timer > UINT16_MAX) ? UINT16_MAX : iron_timer;
+  msg.payload_len = strlen(cur_profile().name);
+  memcpy(msg.payload, cur_profile().name, msg.payload_len);
+
+  if (confirmable && udp_peer_port) {
+    msg.type = UDP_CON;
+    udp_pending_start(udp_tx_pending, msg, millis());
+    udp_tx_first_ms = millis();
+  } else {
+    msg.type = UDP_NON;
+    udp_send(msg, WiFi.broadcastIP(), udp_port);
+  }
+}
+
+/*
+  udp_service()
+
+  Description:
+  ------------
+  * Handle received UDP commands and retransmit an unacknowledged status
+  * Non-blocking, handles at most udp_max_rx_batch datagrams per call
+*/
+void udp_service() {
+  uint8_t buf[udp_header_len + udp_max_payload];
+  udp_msg rx;
+
+  if (!udp_enabled || !WiFi.isConnected()) return;
+
+  for (uint8_t n = 0; n < udp_max_rx_batch && udp.parsePacket() > 0; n++) {
+    int len = udp.read(buf, sizeof(buf));
+    net_counters.packets++;
+    if (len <= 0 || !udp_decode(buf, len, rx)) continue;
+
+    if (rx.type == UDP_ACK) {
+      if (udp_pending_ack(udp_tx_pending, rx)) {
+        blog_d("UDP status ACK in %u ms", millis() - udp_tx_first_ms);
+        net_stats_rtt(net_counters, millis() - udp_tx_first_ms);
+      }
+      continue;
+    }
+    if (rx.type != UDP_CON && rx.type != UDP_NON) continue;
+
+    udp_peer_ip = udp.remoteIP();
+    udp_peer_port = udp.remotePort();
+
+    // A retransmitted command we have already actioned is only ACKed again
+    bool duplicate = udp_rx_any && (rx.msg_id == udp_last_rx_id);
+    udp_rx_any = true;
+    udp_last_rx_id = rx.msg_id;
+
+    udp_msg reply = {};
+    reply.type = UDP_ACK;
+    reply.code = rx.code;
+    reply.msg_id = rx.msg_id;
+
+    switch (rx.code) {
+      case UDP_CODE_EXTEND:
+        if (!udp_token_ok(rx, UDP_TOKEN)) {
+          reply.type = UDP_RST;
+          blog_w("UDP extend from %s refused, bad token", udp_peer_ip.toString().c_str());
+        } else if (!duplicate) {
+          iron_timer = countdown_longer(iron_timer, cur_profile().step_sec);
+          timer_start_sec = iron_timer;
+        }
+        break;
+      case UDP_CODE_OFF:
+      case UDP_CODE_PING:
+        break;
+      default:
+        reply.type = UDP_RST;
+        break;
+    }
+
+    reply.timer_sec = (iron_timer > UINT16_MAX) ? UINT16_MAX : iron_timer;
+    if (rx.type == UDP_CON || reply.type == UDP_RST)
+      udp_send(reply, udp_peer_ip, udp_peer_port);
+
+    if (rx.code == UDP_CODE_OFF)
+      shutdown();  // Does not return, "Off" is published to MQTT if connected
+  }
+
+  if (udp_pending_due(udp_tx_pending, millis()))
+    udp_send(udp_tx_pending.msg, udp_peer_ip, udp_peer_port);
+}
+
+/*
+  mqtt_command()
+
+  Description:
+  ------------
+  * Handle text commands received on the command topic
+      profile <n|name>                  - select timer profile by index (0-3) or name
+      set <duration|step|warning> <sec> - change a setting of the active profile
+      ping <id>                         - reply with <id> on mqtt_pong_topic, see tools/udp_peer.py
+      tlsbench [n]                      - compare n full and resumed TLS handshakes, see tls_bench()
+      bench [stop]                      - run the energy benchmark, about 5 minutes
+
+  Inputs:
+  -------
+  * cmd - null terminated command string
+*/
+void mqtt_command(const char* cmd) {
+  char field[16] = "";
+  unsigned int value = 0;
+
+  if (strncmp(cmd, "profile ", 8) == 0) {
+    const char* arg = cmd + 8;
+    if (arg[0] >= '0' && arg[0] <= '9' && arg[1] == '\0') {
+      if (arg[0] - '0' < max_profiles)
+        profile_select(arg[0] - '0');
+      return;
+    }
+    for (uint8_t n = 0; n < max_profiles; n++) {
+      if (strcasecmp(arg, profile_get(n).name) == 0) {
+        profile_select(n);
+        return;
+      }
+    }
+    blog_w("Unknown profile: %s", arg);
+  } else if (sscanf(cmd, "set %15s %u", field, &value) == 2) {
+    if (!profile_set_field(field, value))
+      blog_w("Rejected: set %s %u", field, value);
+  } else if (strcmp(cmd, "bench") == 0) {
+    if (bench.active) return;
+    bench_start(bench, millis());
+    bench_begin_scenario();
+  } else if (strncmp(cmd, "ping ", 5) == 0) {
+    mqttClient.publish(mqtt_pong_topic, cmd + 5);
+#if MQTT_TLS_MODE
+  } else if (strncmp(cmd, "tlsbench", 8) == 0) {
+    // Runs from loop(), it calls mqttClient.loop() between handshakes
+    if (sscanf(cmd, "tlsbench %u", &value) != 1) value = 5;
+    tls_bench_rounds = constrain(value, 1, mqtt_tls_bench_max);
+#endif
+  } else if (strcmp(cmd, "bench stop") == 0 && bench.active) {
+    bench_end_scenario();
+    bench.active = false;
+    blog_i("Benchmark stopped");
+  }
+}
+
+/*
+  binlog_begin()
+
+  Description:
+  ------------
+  * Start the task that formats and prints log records. It runs at the lowest priority
+    on the other core to loop(), so printing never holds up the display or MQTT
+*/
+void binlog_begin() {
+  xTaskCreatePinnedToCore(binlog_task, "binlog", binlog_task_stack, nullptr, tskIDLE_PRIORITY + 1, nullptr, 0);
+}
+
+uint32_t binlog_now_ms() {
+  return millis();
+}
+
+void binlog_task(void* param) {
+  binlog_rec rec;
+  char line[160];
+  uint32_t dropped_shown = 0;
+
+  for (;;) {
+    while (binlog_read(binlog_main, rec)) {
+      binlog_format(rec, line, sizeof(line));
+      Serial.println(line);
+    }
+    uint32_t dropped = binlog_main.dropped.load();
+    if (dropped != dropped_shown) {
+      Serial.printf("binlog: %u records dropped\n", dropped - dropped_shown);
+      dropped_shown = dropped;
+    }
+    vTaskDelay(pdMS_TO_TICKS(binlog_drain_ms));
+  }
+}
+
+#if BINLOG_BENCH
+/*
+  binlog_benchmark()
+
+  Description:
+  ------------
+  * Time a typical log call against formatting the same message with snprintf, which
+    is the least Serial.printf costs before it even waits for the UART
+  * Uses a scratch ring, so nothing is printed
+*/
+void binlog_benchmark() {
+  binlog_ring* scratch = new binlog_ring();
+  char txt[80];
+
+  uint32_t start_us = micros();
+  for (uint8_t i = 0; i < binlog_bench_calls; i++)
+    binlog_write(*scratch, millis(), binlog_level_info, "MQTT connected to %s:%u in %u ms", "192.168.20.2", 1883, i);
+  uint32_t binlog_us = micros() - start_us;
+
+  start_us = micros();
+  for (uint8_t i = 0; i < binlog_bench_calls; i++)
+    snprintf(txt, sizeof(txt), "MQTT connected to %s:%u in %u ms", "192.168.20.2", 1883, i);
+  uint32_t snprintf_us = micros() - start_us;
+
+  delete scratch;
+  blog_i("Log call cost: binlog %u ns, snprintf %u ns", binlog_us * 1000 / binlog_bench_calls, snprintf_us * 1000 / binlog_bench_calls);
+}
+#endif
+
+/*
+  bench_begin_scenario()
+
+  Description:
+  ------------
+  * Set the device up for the benchmark scenario about to run
+*/
+void bench_begin_scenario() {
+  blog_i("Benchmark: %s for %us", bench_scenario_names[bench.scenario], bench_scenario_ms / 1000);
+  bench_step = 0;
+  bench_last_action = millis();
+  bench_last_sample = millis() - bench_sample_ms;  // First sample straight away
+
+  switch (bench.scenario) {
+    case BENCH_OTA:
+      myOTA_onStart();  // Also keeps the radio awake, as during a real upload
+      break;
+    case BENCH_SCREEN_OFF:
+      bench_brightness = M5.Lcd.getBrightness();
+      M5.Lcd.sleep();
+      M5.Lcd.setBrightness(0);
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+  bench_end_scenario()
+
+  Description:
+  ------------
+  * Report the scenario just finished and put the device back to normal
+*/
+void bench_end_scenario() {
+  bool on_battery = M5.Power.Axp192.getVBUSVoltage() < 4.0f && M5.Power.Axp192.getACINVolatge() < 4.0f;
+  bench_report_json(bench_unsent[bench.scenario], bench_json_len, bench, sw_version, on_battery);
+  // The full JSON is too long for a log record, the log gets the figures that matter
+  blog_i("Benchmark %s: %.4f mAh, avg %.1f mA, max %.1f mA%s", bench_scenario_names[bench.scenario], energy_mah(bench.acc), energy_avg_ma(bench.acc),
+         bench.acc.max_ma, on_battery ? "" : ", on USB power");
+  bench_publish_unsent();
+
+  switch (bench.scenario) {
+    case BENCH_OTA:
+      WiFi.setSleep(net_ps_mode);
+      ota_screen_restore();
+      break;
+    case BENCH_SCREEN_OFF:
+      M5.Lcd.wakeup();
+      M5.Lcd.setBrightness(bench_brightness);
+      for (uint8_t w = 0; w < W_COUNT; w++)
+        if (ui_is_visible(ui, w)) ui_invalidate(ui, w);
+      ui_refresh();
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+  bench_service()
+
+  Description:
+  ------------
+  * Sample the PMU current, drive the load of the current scenario and move on to the
+    next scenario when it has run for bench_scenario_ms
+  * The current is everything flowing in: battery discharge plus USB and ACIN, so the
+    figures hold whichever way the Core2 is powered, as long as it isn't charging
+*/
+void bench_service() {
+  if (!bench.active) return;
+
+  if (millis() - bench_last_sample >= bench_sample_ms) {
+    bench_last_sample = millis();
+    float current = M5.Power.Axp192.getBatteryDischargeCurrent() + M5.Power.Axp192.getVBUSCurrent() + M5.Power.Axp192.getACINCurrent();
+    energy_add(bench.acc, current, bench_last_sample);
+  }
+
+  // The countdown keeps running for realism, but must not switch off or raise alerts. Top up
+  // a tick before the warning, the first of them
+  if (iron_timer <= cur_profile().warning_sec + 1u)
+    iron_timer = cur_profile().duration_sec;
+
+  switch (bench.scenario) {
+    case BENCH_TOUCH:
+      // Sweep the bar back and forth, the same repaint a finger dragging across the slider causes
+      if (millis() - bench_last_action >= bench_drag_ms) {
+        bench_last_action = millis();
+        bench_step = (bench_step + 1) % 200;
+        ui_set_bar(bench_step <= 100 ? bench_step : 200 - bench_step);
+        ui_refresh();
+      }
+      break;
+    case BENCH_OTA:
+      if (millis() - bench_last_action >= bench_ota_step_ms) {
+        bench_last_action = millis();
+        bench_step = (bench_step + 1) % 100;
+        myOTA_onProgress(bench_step, 100);
+      }
+      break;
+    case BENCH_RECONNECT:
+      // Drop the connection as soon as it is up, loop() reconnects as fast as it is allowed to
+      if (mqttClient.connected())
+        mqttClient.disconnect();
+      break;
+    default:
+      break;
+  }
+
+  if (bench_scenario_done(bench, millis())) {
+    bench_end_scenario();
+    if (bench_next(bench, millis()))
+      bench_begin_scenario();
+    else
+      blog_i("Benchmark finished");
+  }
+}
+
+/*
+  bench_publish_unsent()
+
+  Description:
+  ------------
+  * Publish the scenario reports MQTT was down for, in scenario order. The reconnect
+    scenario always ends with the connection dropped, so its report goes out from
+    reconnect() once the next scenario is back online
+*/
+void bench_publish_unsent() {
+  if (!mqttClient.connected()) return;
+
+  for (uint8_t s = 0; s < BENCH_COUNT; s++)
+    if (bench_unsent[s][0] && mqttClient.publish(bench_topic, bench_unsent[s]))
+      bench_unsent[s][0] = '\0';
+}
+
+/*
+  profiles_begin()
+
+  Description:
+  ------------
+  * Open the NVS namespace and load only the active profile
+*/
+void profiles_begin() {
+  prefs.begin(profile_nvs_namespace, false);
+  active_profile = prefs.getUChar("active", 0);
+  if (active_profile >= max_profiles)
+    active_profile = 0;
+  stored_active_profile = active_profile;
+  profile_apply();
+}
+
+/*
+  profile_get()
+
+  Description:
+  ------------
+  * Return profile n, reading it from NVS the first time it is needed
+  * Missing or corrupt records fall back to the built in default for that slot
+*/
+timer_profile& profile_get(uint8_t n) {
+  if (n >= max_profiles) n = 0;
+
+  if (!(profiles_loaded & (1 << n))) {
+    char key[4] = {'p', (char)('0' + n), '\0'};
+    timer_profile& p = profiles[n];
+    if (prefs.getBytes(key, &p, sizeof(timer_profile)) != sizeof(timer_profile) || !profile_valid(&p)) {
+      p = default_profiles[n];
+      profile_seal(&p);
+    }
+    profiles_loaded |= (1 << n);
+  }
+  return profiles[n];
+}
+
+timer_profile& cur_profile() {
+  return profile_get(active_profile);
+}
+
+/*
+  profile_apply()
+
+  Description:
+  ------------
+  * Start the timer with the active profile and redraw the bar graph scale for its duration
+*/
+void profile_apply() {
+  timer_profile& p = cur_profile();
+
+  stateTopic = p.state_topic;
+  commandTopic = p.cmd_topic;
+  iron_timer = p.duration_sec;
+  timer_start_sec = p.duration_sec;
+  ui_invalidate(ui, W_SCALE);
+  ui_invalidate(ui, W_TIMER_TEXT);
+}
+
+/*
+  profile_select()
+
+  Description:
+  ------------
+  * Switch to another appliance's profile: the old appliance is switched off,
+    the new one on, and the timer restarts at the new profile's duration
+
+  Inputs:
+  -------
+  * n - profile index
+*/
+void profile_select(uint8_t n) {
+  if (n >= max_profiles || n == active_profile)
+    return;
+
+  // The appliance sees an off/on cycle, both go out together in the next window, followed by
+  // the move to the new command topic. Keep the one still subscribed if a move is pending
+  mqtt_state_queue("Off");
+  if (!mqtt_old_cmd_topic[0])
+    strncpy(mqtt_old_cmd_topic, commandTopic, sizeof(mqtt_old_cmd_topic) - 1);
+
+  active_profile = n;
+  profile_apply();
+  profile_changed_ms = millis();
+  profile_msg_until = millis() + profile_msg_ms;
+  blog_i("Profile %u: %s, %us", n, cur_profile().name, cur_profile().duration_sec);
+  alert_play(&alert_profile);
+
+  mqtt_state_queue("On");
+  udp_send_status(true);
+}
+
+/*
+  profile_set_field()
+
+  Description:
+  ------------
+  * Change one setting of the active profile. Only marks it for writing, see profiles_flush()
+
+  Return:
+  -------
+  * false if the field is unknown or the new value would make the profile invalid
+*/
+bool profile_set_field(const char* field, uint32_t value) {
+  timer_profile p = cur_profile();
+
+  if (value > UINT16_MAX) return false;
+
+  if (strcmp(field, "duration") == 0)
+    p.duration_sec = value;
+  else if (strcmp(field, "step") == 0)
+    p.step_sec = value;
+  else if (strcmp(field, "warning") == 0 && value <= UINT8_MAX)
+    p.warning_sec = value;
+  else
+    return false;
+
+  profile_seal(&p);
+  if (!profile_valid(&p)) return false;
+  if (p.crc == cur_profile().crc) return true;  // No change, nothing to write
+
+  cur_profile() = p;
+  profiles_dirty |= (1 << active_profile);
+  profile_changed_ms = millis();
+  ui_invalidate(ui, W_SCALE);
+  return true;
+}
+
+/*
+  profiles_flush()
+
+  Description:
+  ------------
+  * Write changed profiles and the active profile index to NVS
+  * Changes are batched: nothing is written until profile_save_delay_ms after the last
+    change, and unchanged values are never rewritten, to keep flash wear down
+
+  Inputs:
+  -------
+  * force - write now regardless of the delay, e.g. before deep sleep
+*/
+void profiles_flush(bool force) {
+  if (!profiles_dirty && active_profile == stored_active_profile)
+    return;
+  if (!force && (millis() - profile_changed_ms < profile_save_delay_ms))
+    return;
+
+  for (uint8_t n = 0; n < max_profiles; n++) {
+    if (profiles_dirty & (1 << n)) {
+      char key[4] = {'p', (char)('0' + n), '\0'};
+      prefs.putBytes(key, &profiles[n], sizeof(timer_profile));
+    }
+  }
+  profiles_dirty = 0;
+
+  if (active_profile != stored_active_profile) {
+    prefs.putUChar("active", active_profile);
+    stored_active_profile = active_profile;
+  }
+}
+
+/*
+  reconnect()
+
+  Description:
+  ------------
+  * Connect to the healthiest MQTT broker, see broker_list.h and broker_race.h
+  * The TCP connect is non-blocking and polled on each call, racing a second broker if the
+    first is slow, so loop() carries on while a broker is down or unreachable
+  * With MQTT_TLS_MODE the TLS handshake follows on the same socket, one step per call.
+    The session of the last handshake with this broker is offered, see tls_client.h
+  * The one wait left is PubSubClient waiting for the CONNACK, up to mqtt_socket_timeout_sec.
+    It only happens once a broker has accepted the connection, on the LAN the
+    CONNACK follows in a few ms
 */
 void reconnect() {
-  // Loop until we're reconnected
-  while (!mqttClient.connected()) {
-    Serial.print("Attempting MQTT connection...");
+  int fd = -1;
+  uint8_t idx = broker_no_pick;
+
+#if MQTT_TLS_MODE
+  if (wifiClient.state() != TLS_HANDSHAKE) {
+    if (broker_race_poll(mqtt_race, mqtt_broker_list, millis(), mqtt_connect_timeout_ms, fd, idx) != RACE_CONNECTED)
+      return;
+
+    // A session is only any use with the broker that issued it
+    if (idx != tls_session_broker) {
+      wifiClient.session_forget();
+      tls_session_broker = broker_no_pick;
+    }
+    wifiClient.start(fd, IPAddress(mqtt_brokers[idx].ip).toString().c_str());
+  }
+
+  if (wifiClient.handshake() == TLS_HANDSHAKE)
+    return;
+
+  idx = mqtt_race.winner;
+  mqtt_broker& broker = mqtt_brokers[idx];
+  IPAddress broker_ip(broker.ip);
+  bool ok = (wifiClient.state() == TLS_CONNECTED);
+  if (ok) {
+    tls_session_broker = idx;
+    blog_i("MQTT TLS %s handshake in %u ms, peak heap %u bytes", wifiClient.session_resumed() ? "resumed" : "full", wifiClient.handshake_ms, wifiClient.heap_peak);
+  } else {
+    blog_w("MQTT TLS handshake with %s failed, error -0x%04x", broker_ip.toString().c_str(), -wifiClient.last_error);
+  }
+#else
+  if (broker_race_poll(mqtt_race, mqtt_broker_list, millis(), mqtt_connect_timeout_ms, fd, idx) != RACE_CONNECTED)
+    return;
+
+  mqtt_broker& broker = mqtt_brokers[idx];
+  IPAddress broker_ip(broker.ip);
+  wifiClient = WiFiClient(fd);
+  bool ok = true;
+#endif
+
+  if (ok) {
     // Create a random mqttClient ID
     String clientId = "ESP32Client-";
     clientId += String(random(0xffff), HEX);
-    // Attempt to connect
-    if (mqttClient.connect(clientId.c_str(), mqttUser, mqttPassword)) {
-      Serial.println("connected");
-      // Once connected, publish switch turn ON
-      mqttClient.publish(stateTopic, "On");
-      // ... and resubscribe
-      mqttClient.subscribe(commandTopic);
-    } else {
-      Serial.print("failed, rc=");
-      Serial.print(mqttClient.state());
-      Serial.println(" try again in 5 seconds");
-      // Wait 5 seconds before retrying
-      delay(5000);
-    }
+    mqttClient.setServer(broker_ip, broker.port);
+    // The socket is already open, PubSubClient only sends CONNECT and waits for the CONNACK
+    ok = mqttClient.connect(clientId.c_str(), mqttUser, mqttPassword);
+  }
+  // Only now does the broker count as good, a TCP connect alone doesn't show it accepts MQTT
+  uint32_t elapsed = broker_race_done(mqtt_race, mqtt_broker_list, ok, millis());
+  if (!ok) {
+    wifiClient.stop();
+    blog_w("MQTT connect to %s:%u failed, rc=%d, retry in %u ms", broker_ip.toString().c_str(), broker.port, mqttClient.state(), broker.retry_at_ms - millis());
+    return;
+  }
+
+  blog_i("MQTT connected to %s:%u in %u ms", broker_ip.toString().c_str(), broker.port, elapsed);
+  // Once connected, publish switch turn ON in the next window
+  mqtt_state_queue("On");
+  // ... and resubscribe straight away, the radio is still up from the CONNACK. A clean
+  // session holds no old subscription to move
+  mqttClient.subscribe(commandTopic);
+  mqtt_old_cmd_topic[0] = '\0';
+  bench_publish_unsent();
+}
+
+#if MQTT_TLS_MODE
+struct tls_bench_stats {
+  uint8_t count;
+  uint32_t min_ms;
+  uint32_t max_ms;
+  uint32_t total_ms;
+  uint32_t heap_peak;  // Largest of the handshakes
+};
+
+void tls_bench_add(tls_bench_stats& s, const tls_client& c) {
+  s.count++;
+  s.min_ms = (s.count == 1) ? c.handshake_ms : min(s.min_ms, c.handshake_ms);
+  s.max_ms = max(s.max_ms, c.handshake_ms);
+  s.total_ms += c.handshake_ms;
+  s.heap_peak = max(s.heap_peak, c.heap_peak);
+}
+
+/*
+  tls_bench()
+
+  Description:
+  ------------
+  * Compare full and resumed TLS handshakes with the connected MQTT broker. For a
+    repeatable run point mqtt_brokers[] at a local broker, e.g. one started by
+    tools/tls_broker.sh
+  * Each round is a full handshake with no session offered, then one offering the
+    session it created, on a second connection so MQTT stays up. Handshakes are counted
+    by what the broker did: a refused resumption counts as a full handshake
+  * Logs and publishes the min, average and max time and the largest peak heap of each
+    kind as JSON on mqtt_tls_bench_topic
+  * Blocks loop() for the whole run, about a second per round
+
+  Inputs:
+  -------
+  * rounds - rounds to run, up to mqtt_tls_bench_max
+*/
+void tls_bench(uint8_t rounds) {
+  if (!mqttClient.connected() || tls_session_broker == broker_no_pick) return;
+
+  mqtt_broker& broker = mqtt_brokers[tls_session_broker];
+  IPAddress broker_ip(broker.ip);
+  tls_client* client = new tls_client();  // Its mbedTLS contexts are too big for the loop() stack
+  client->set_ca_cert(MQTT_CA_CERT);
+  client->set_handshake_timeout(mqtt_tls_timeout_ms);
+
+  tls_bench_stats full = {};
+  tls_bench_stats resumed = {};
+  uint8_t failed = 0;
+  for (uint8_t n = 0; n < rounds * 2; n++) {
+    if (n % 2 == 0) client->session_forget();
+    bool ok = client->connect(broker_ip, broker.port);
+    client->stop();
+    if (!ok)
+      failed++;
+    else
+      tls_bench_add(client->session_resumed() ? resumed : full, *client);
+    mqttClient.loop();  // Keep the MQTT session alive
   }
+  delete client;
+
+  blog_i("TLS bench full: %u handshakes, min %u avg %u max %u ms, peak heap %u bytes", full.count, full.min_ms, full.count ? full.total_ms / full.count : 0, full.max_ms, full.heap_peak);
+  blog_i("TLS bench resumed: %u handshakes, min %u avg %u max %u ms, peak heap %u bytes", resumed.count, resumed.min_ms, resumed.count ? resumed.total_ms / resumed.count : 0, resumed.max_ms, resumed.heap_peak);
+  if (failed) blog_w("TLS bench: %u handshakes failed", failed);
+
+  char json[200];
+  snprintf(json, sizeof(json),
+           "{\"full\":{\"n\":%u,\"min_ms\":%u,\"avg_ms\":%u,\"max_ms\":%u,\"heap\":%u},"
+           "\"resumed\":{\"n\":%u,\"min_ms\":%u,\"avg_ms\":%u,\"max_ms\":%u,\"heap\":%u},\"failed\":%u}",
+           full.count, full.min_ms, full.count ? full.total_ms / full.count : 0, full.max_ms, full.heap_peak,
+           resumed.count, resumed.min_ms, resumed.count ? resumed.total_ms / resumed.count : 0, resumed.max_ms, resumed.heap_peak, failed);
+  mqttClient.publish(mqtt_tls_bench_topic, json);
 }
+#endif
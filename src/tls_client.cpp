@@ -0,0 +1,334 @@
+/*
+  tls_client.cpp
+
+  Description:
+  ------------
+  * See tls_client.h. The socket stays non-blocking after the handshake: read() and
+    available() return straight away when there is no data, write() waits up to the
+    handshake timeout for room in the socket buffer
+*/
+#include "tls_client.h"
+
+#include <WiFi.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <lwip/sockets.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/version.h>
+
+// mbedTLS 3.2 has an accessor for this. Older versions have none, but the negotiated session
+// only becomes the current one at the end of the handshake, and get_ciphersuite() reads that
+static bool handshake_over(const mbedtls_ssl_context* ssl) {
+#if MBEDTLS_VERSION_NUMBER >= 0x03020000
+  return mbedtls_ssl_is_handshake_over(ssl);
+#else
+  return mbedtls_ssl_get_ciphersuite(ssl) != nullptr;
+#endif
+}
+
+tls_client::tls_client() {
+  mbedtls_ssl_init(&ssl);
+  mbedtls_ssl_config_init(&conf);
+  mbedtls_ssl_session_init(&session);
+  mbedtls_x509_crt_init(&ca);
+  mbedtls_entropy_init(&entropy);
+  mbedtls_ctr_drbg_init(&drbg);
+}
+
+tls_client::~tls_client() {
+  stop();
+  mbedtls_ssl_session_free(&session);
+  mbedtls_ssl_config_free(&conf);
+  mbedtls_x509_crt_free(&ca);
+  mbedtls_ctr_drbg_free(&drbg);
+  mbedtls_entropy_free(&entropy);
+}
+
+void tls_client::set_ca_cert(const char* pem) {
+  ca_pem = pem;
+}
+
+// Seed the RNG and build the client config, once. Not done in the constructor as the client is a global
+bool tls_client::init() {
+  if (ready) return true;
+
+  int err = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, nullptr, 0);
+  if (!err) err = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+  if (!err && ca_pem) err = mbedtls_x509_crt_parse(&ca, (const unsigned char*)ca_pem, strlen(ca_pem) + 1);
+  if (err) {
+    last_error = err;
+    return false;
+  }
+
+  mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+  mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_ca_chain(&conf, &ca, nullptr);
+  mbedtls_ssl_conf_verify(&conf, verify_cert, this);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+  ready = true;
+  return true;
+}
+
+/*
+  tls_client::start()
+
+  Description:
+  ------------
+  * Take over a connected socket and begin the handshake, offering the kept session if
+    there is one. The socket is closed by stop(), including when start() fails
+
+  Inputs:
+  -------
+  * fd   - connected TCP socket, e.g. from broker_race_poll()
+  * host - name checked against the broker certificate, the IP address as text for a
+           broker on the LAN
+*/
+void tls_client::start(int fd, const char* host) {
+  stop();
+  sock = fd;
+  resumed = false;
+  last_error = 0;
+  start_ms = millis();
+  heap_start = ESP.getFreeHeap();  // Before mbedtls_ssl_setup(), which allocates the record buffers
+  heap_low = heap_start;
+  heap_min_start = ESP.getMinFreeHeap();
+  conn_state = TLS_HANDSHAKE;
+
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+  if (!init()) {
+    fail(last_error);
+    return;
+  }
+
+  int err = mbedtls_ssl_setup(&ssl, &conf);
+  if (!err) err = mbedtls_ssl_set_hostname(&ssl, host);
+  if (!err && has_session) {
+    err = mbedtls_ssl_set_session(&ssl, &session);
+    resumed = (err == 0);  // Until the broker sends its certificate, see verify_cert()
+  }
+  if (err) {
+    fail(err);
+    return;
+  }
+  mbedtls_ssl_set_bio(&ssl, this, bio_send, bio_recv, nullptr);
+}
+
+/*
+  tls_client::handshake()
+
+  Description:
+  ------------
+  * Run one handshake step, call from loop() while it returns TLS_HANDSHAKE. Each call
+    does at most one message's worth of work, the slow ones are the certificate check
+    and the key exchange of a full handshake
+  * On success the new session is kept for the next connection
+
+  Return:
+  -------
+  * See tls_state
+*/
+tls_state tls_client::handshake() {
+  if (conn_state != TLS_HANDSHAKE) return conn_state;
+
+  int err = mbedtls_ssl_handshake_step(&ssl);
+  sample_heap();
+  if (err && err != MBEDTLS_ERR_SSL_WANT_READ && err != MBEDTLS_ERR_SSL_WANT_WRITE) {
+    fail(err);
+    return conn_state;
+  }
+
+  if (!handshake_over(&ssl)) {
+    if (millis() - start_ms > handshake_timeout_ms)
+      fail(MBEDTLS_ERR_SSL_TIMEOUT);
+    return conn_state;
+  }
+
+  // Peak heap: the low water mark also catches memory freed again within a step, but only
+  // moves when it is a new low for this boot, so keep the per step samples as well
+  uint32_t heap_min = ESP.getMinFreeHeap();
+  if (heap_min < heap_min_start && heap_min < heap_low) heap_low = heap_min;
+  heap_peak = heap_start - heap_low;
+  handshake_ms = millis() - start_ms;
+
+  mbedtls_ssl_session_free(&session);
+  mbedtls_ssl_session_init(&session);
+  has_session = (mbedtls_ssl_get_session(&ssl, &session) == 0);
+  conn_state = TLS_CONNECTED;
+  return conn_state;
+}
+
+void tls_client::sample_heap() {
+  uint32_t heap = ESP.getFreeHeap();
+  if (heap < heap_low) heap_low = heap;
+}
+
+void tls_client::fail(int err) {
+  last_error = err;
+  conn_state = TLS_FAILED;
+}
+
+/*
+  tls_client::session_save()
+
+  Description:
+  ------------
+  * Serialise the kept session, e.g. into the RTC snapshot before deep sleep
+
+  Return:
+  -------
+  * false if there is no session or buf is too small
+*/
+bool tls_client::session_save(uint8_t* buf, size_t buf_len, size_t& len) const {
+  len = 0;
+  return has_session && mbedtls_ssl_session_save(&session, buf, buf_len, &len) == 0;
+}
+
+// Returns false if buf doesn't hold a session from this firmware's mbedTLS build
+bool tls_client::session_load(const uint8_t* buf, size_t len) {
+  session_forget();
+  if (len == 0) return false;
+
+  has_session = (mbedtls_ssl_session_load(&session, buf, len) == 0);
+  if (!has_session) session_forget();
+  return has_session;
+}
+
+// Next handshake is a full one, e.g. when connecting to a different broker
+void tls_client::session_forget() {
+  mbedtls_ssl_session_free(&session);
+  mbedtls_ssl_session_init(&session);
+  has_session = false;
+}
+
+int tls_client::connect(IPAddress ip, uint16_t port) {
+  return connect(ip, port, (int32_t)handshake_timeout_ms);
+}
+
+int tls_client::connect(IPAddress ip, uint16_t port, int32_t timeout_ms) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = (uint32_t)ip;
+
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) return 0;
+  if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return 0;
+  }
+
+  handshake_timeout_ms = timeout_ms;
+  start(fd, ip.toString().c_str());
+  while (handshake() == TLS_HANDSHAKE)
+    delay(1);
+  return conn_state == TLS_CONNECTED;
+}
+
+int tls_client::connect(const char* host, uint16_t port) {
+  IPAddress ip;
+  if (!WiFi.hostByName(host, ip)) return 0;
+  return connect(ip, port);
+}
+
+size_t tls_client::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t tls_client::write(const uint8_t* buf, size_t size) {
+  size_t done = 0;
+  uint32_t start = millis();
+
+  while (conn_state == TLS_CONNECTED && done < size) {
+    int n = mbedtls_ssl_write(&ssl, buf + done, size - done);
+    if (n > 0) {
+      done += n;
+    } else if (n != MBEDTLS_ERR_SSL_WANT_WRITE && n != MBEDTLS_ERR_SSL_WANT_READ) {
+      fail(n);
+    } else if (millis() - start > handshake_timeout_ms) {
+      fail(MBEDTLS_ERR_SSL_TIMEOUT);
+    } else {
+      delay(1);  // Socket buffer full, let lwIP send
+    }
+  }
+  return done;
+}
+
+int tls_client::available() {
+  if (conn_state != TLS_CONNECTED) return 0;
+
+  // A zero length read processes any record waiting on the socket without consuming data
+  int err = mbedtls_ssl_read(&ssl, nullptr, 0);
+  if (err < 0 && err != MBEDTLS_ERR_SSL_WANT_READ && err != MBEDTLS_ERR_SSL_WANT_WRITE)
+    fail(err);
+  return (int)mbedtls_ssl_get_bytes_avail(&ssl) + (peeked >= 0 ? 1 : 0);
+}
+
+int tls_client::read(uint8_t* buf, size_t size) {
+  if (size == 0) return 0;
+  int n = 0;
+  if (peeked >= 0) {
+    buf[n++] = (uint8_t)peeked;
+    peeked = -1;
+    if (--size == 0) return n;
+  }
+  if (conn_state != TLS_CONNECTED) return n ? n : -1;
+
+  int got = mbedtls_ssl_read(&ssl, buf + n, size);
+  if (got > 0) return n + got;
+  if (got != MBEDTLS_ERR_SSL_WANT_READ && got != MBEDTLS_ERR_SSL_WANT_WRITE)
+    fail(got ? got : MBEDTLS_ERR_SSL_CONN_EOF);
+  return n ? n : -1;
+}
+
+int tls_client::read() {
+  uint8_t b;
+  return (read(&b, 1) == 1) ? b : -1;
+}
+
+int tls_client::peek() {
+  if (peeked < 0) peeked = read();
+  return peeked;
+}
+
+void tls_client::stop() {
+  if (conn_state == TLS_CONNECTED)
+    mbedtls_ssl_close_notify(&ssl);  // Best effort, the socket is non-blocking
+  mbedtls_ssl_free(&ssl);
+  mbedtls_ssl_init(&ssl);
+  if (sock >= 0) close(sock);
+  sock = -1;
+  peeked = -1;
+  conn_state = TLS_IDLE;
+}
+
+uint8_t tls_client::connected() {
+  if (conn_state == TLS_CONNECTED) available();  // Notices a close from the broker
+  return conn_state == TLS_CONNECTED || peeked >= 0;
+}
+
+int tls_client::bio_send(void* ctx, const unsigned char* buf, size_t len) {
+  tls_client* c = static_cast<tls_client*>(ctx);
+  int n = send(c->sock, buf, len, 0);
+  if (n >= 0) return n;
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return MBEDTLS_ERR_SSL_WANT_WRITE;
+  if (errno == EPIPE || errno == ECONNRESET) return MBEDTLS_ERR_NET_CONN_RESET;
+  return MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+int tls_client::bio_recv(void* ctx, unsigned char* buf, size_t len) {
+  tls_client* c = static_cast<tls_client*>(ctx);
+  int n = recv(c->sock, buf, len, 0);
+  if (n >= 0) return n;  // 0 is end of stream, mbedTLS reports it
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return MBEDTLS_ERR_SSL_WANT_READ;
+  if (errno == ECONNRESET) return MBEDTLS_ERR_NET_CONN_RESET;
+  return MBEDTLS_ERR_NET_RECV_FAILED;
+}
+
+// Only called when the broker sends its certificate, which it skips when it accepts the offered session
+int tls_client::verify_cert(void* ctx, mbedtls_x509_crt*, int, uint32_t*) {
+  static_cast<tls_client*>(ctx)->resumed = false;
+  return 0;  // Leave the verdict to the CA chain check
+}
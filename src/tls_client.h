@@ -0,0 +1,96 @@
+/*
+  tls_client.h
+
+  Description:
+  ------------
+  * Arduino Client for MQTT over TLS, built directly on mbedTLS in place of WiFiClientSecure
+  * Takes over a socket that broker_race.h has already connected and runs the handshake
+    one step per call from loop(), so a slow broker never blocks the UI
+  * Keeps the TLS session after each handshake (mbedtls_ssl_get_session) and offers it
+    on the next connection (mbedtls_ssl_set_session). A broker that accepts it, by
+    session ID or session ticket (RFC 5077), skips the certificate chain and the key
+    exchange. session_save() / session_load() carry it through deep sleep in the RTC
+    snapshot
+  * Records the time and peak heap of each handshake, see tls_bench() in main.cpp
+*/
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+enum tls_state : uint8_t {
+  TLS_IDLE = 0,   // No connection
+  TLS_HANDSHAKE,  // Call handshake() until it returns something else
+  TLS_CONNECTED,
+  TLS_FAILED,     // Handshake failed or timed out, or the connection was lost. last_error says why
+};
+
+class tls_client : public Client {
+ public:
+  tls_client();
+  ~tls_client();
+
+  void set_ca_cert(const char* pem);
+  void set_handshake_timeout(uint32_t ms) { handshake_timeout_ms = ms; }
+
+  void start(int fd, const char* host);
+  tls_state handshake();
+  tls_state state() const { return conn_state; }
+
+  bool session_resumed() const { return resumed; }
+  bool session_save(uint8_t* buf, size_t buf_len, size_t& len) const;
+  bool session_load(const uint8_t* buf, size_t len);
+  void session_forget();
+
+  // Last handshake
+  uint32_t handshake_ms = 0;
+  uint32_t heap_peak = 0;  // Bytes, from the lowest free heap seen during the handshake
+  int last_error = 0;      // mbedTLS error code, 0 if none
+
+  // Client, connect() is blocking and only used by tls_bench()
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(IPAddress ip, uint16_t port, int32_t timeout_ms);
+  int connect(const char* host, uint16_t port) override;
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buf, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+
+ private:
+  bool init();
+  void fail(int err);
+  void sample_heap();
+  static int bio_send(void* ctx, const unsigned char* buf, size_t len);
+  static int bio_recv(void* ctx, unsigned char* buf, size_t len);
+  static int verify_cert(void* ctx, mbedtls_x509_crt* crt, int depth, uint32_t* flags);
+
+  int sock = -1;
+  tls_state conn_state = TLS_IDLE;
+  bool ready = false;        // init() done
+  bool has_session = false;  // session holds one to offer
+  bool resumed = false;       // Offered session accepted, i.e. no certificate came
+  int peeked = -1;
+  const char* ca_pem = nullptr;
+  uint32_t handshake_timeout_ms = 3000;
+  uint32_t start_ms = 0;
+  uint32_t heap_start = 0;
+  uint32_t heap_low = 0;
+  uint32_t heap_min_start = 0;
+
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config conf;
+  mbedtls_ssl_session session;
+  mbedtls_x509_crt ca;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context drbg;
+};
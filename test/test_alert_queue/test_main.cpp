@@ -0,0 +1,195 @@
+/*
+  test_alert_queue
+
+  Description:
+  ------------
+  * alert_push(): higher priority cuts in, equal priority waits, feedback is dropped
+    while anything plays, duplicates are ignored and a full queue drops the lowest
+  * alert_final_at() and the last seconds of each default profile played on a virtual
+    clock: the warning always plays before the final alert, and both play in full
+*/
+#include <unity.h>
+
+#include "alert_queue.h"
+#include "timer_profiles.h"
+
+static const alert_step click_steps[] = {
+    {ALERT_STEP_VIBRATE, 180, 200},
+    {ALERT_STEP_END, 0, 0},
+};
+static const alert_step info_steps[] = {
+    {ALERT_STEP_TONE, 1320, 60},
+    {ALERT_STEP_PAUSE, 0, 40},
+    {ALERT_STEP_TONE, 1760, 60},
+    {ALERT_STEP_END, 0, 0},
+};
+static const alert_step warning_steps[] = {
+    {ALERT_STEP_PCM, 0, alert_chime_ms},
+    {ALERT_STEP_VIBRATE, 180, 200},
+    {ALERT_STEP_PAUSE, 0, 150},
+    {ALERT_STEP_VIBRATE, 180, 200},
+    {ALERT_STEP_END, 0, 0},
+};
+static const alert_step final_steps[] = {
+    {ALERT_STEP_TONE, 2000, 100},
+    {ALERT_STEP_PAUSE, 0, 100},
+    {ALERT_STEP_TONE, 2000, 300},
+    {ALERT_STEP_VIBRATE, 255, 400},
+    {ALERT_STEP_END, 0, 0},
+};
+
+static const alert_def click = {"click", ALERT_PRIO_FEEDBACK, click_steps};
+static const alert_def info = {"info", ALERT_PRIO_INFO, info_steps};
+static const alert_def info2 = {"info2", ALERT_PRIO_INFO, info_steps};
+static const alert_def warning = {"warning", ALERT_PRIO_WARNING, warning_steps};
+static const alert_def final_alert = {"final", ALERT_PRIO_CRITICAL, final_steps};
+
+static alert_queue q;
+
+// Start the first queued alert playing
+static void start_playing(uint32_t now_ms) {
+  alert_step step;
+  const alert_def* finished;
+  TEST_ASSERT_EQUAL(ALERT_ACT_STEP, alert_service(q, now_ms, step, finished));
+}
+
+void setUp(void) {
+  q = {};
+}
+
+void tearDown(void) {
+}
+
+void test_higher_priority_cuts_in(void) {
+  alert_push(q, &warning);
+  start_playing(0);
+  TEST_ASSERT_EQUAL_PTR(&warning, q.current);
+
+  TEST_ASSERT_TRUE(alert_push(q, &final_alert));
+  TEST_ASSERT_NULL(q.current);  // The warning is dropped, not resumed
+  TEST_ASSERT_EQUAL(1, q.count);
+
+  alert_step step;
+  const alert_def* finished;
+  TEST_ASSERT_EQUAL(ALERT_ACT_STEP, alert_service(q, 10, step, finished));
+  TEST_ASSERT_EQUAL_PTR(&final_alert, q.current);
+  TEST_ASSERT_EQUAL(2000, step.arg);
+}
+
+void test_equal_priority_waits(void) {
+  alert_push(q, &info);
+  start_playing(0);
+
+  TEST_ASSERT_FALSE(alert_push(q, &info2));
+  TEST_ASSERT_EQUAL_PTR(&info, q.current);
+  TEST_ASSERT_EQUAL(1, q.count);
+  TEST_ASSERT_EQUAL_PTR(&info2, q.pending[0]);
+}
+
+void test_feedback_dropped_while_playing(void) {
+  alert_push(q, &info);
+  start_playing(0);
+
+  TEST_ASSERT_FALSE(alert_push(q, &click));
+  TEST_ASSERT_EQUAL(0, q.count);
+
+  // Nothing playing, a click goes straight in
+  q = {};
+  alert_push(q, &click);
+  TEST_ASSERT_EQUAL(1, q.count);
+}
+
+void test_duplicate_ignored(void) {
+  alert_push(q, &warning);
+  TEST_ASSERT_FALSE(alert_push(q, &warning));
+  TEST_ASSERT_EQUAL(1, q.count);
+
+  start_playing(0);
+  TEST_ASSERT_FALSE(alert_push(q, &warning));  // Already playing
+  TEST_ASSERT_EQUAL(0, q.count);
+}
+
+void test_full_queue_drops_lowest(void) {
+  static const alert_def infos[alert_queue_len] = {
+      {"i0", ALERT_PRIO_INFO, info_steps},
+      {"i1", ALERT_PRIO_INFO, info_steps},
+      {"i2", ALERT_PRIO_INFO, info_steps},
+      {"i3", ALERT_PRIO_INFO, info_steps},
+  };
+  for (uint8_t i = 0; i < alert_queue_len; i++)
+    alert_push(q, &infos[i]);
+  TEST_ASSERT_EQUAL(alert_queue_len, q.count);
+
+  // A warning goes to the front, the last info falls off the end
+  alert_push(q, &warning);
+  TEST_ASSERT_EQUAL(alert_queue_len, q.count);
+  TEST_ASSERT_EQUAL_PTR(&warning, q.pending[0]);
+  TEST_ASSERT_EQUAL_PTR(&infos[2], q.pending[alert_queue_len - 1]);
+
+  // Nothing lower to make room for another info
+  alert_push(q, &info);
+  for (uint8_t i = 0; i < q.count; i++)
+    TEST_ASSERT_NOT_EQUAL(&info, q.pending[i]);
+}
+
+void test_final_never_before_warning(void) {
+  TEST_ASSERT_EQUAL(2, alert_final_at(5));  // Iron
+  TEST_ASSERT_EQUAL(5, alert_final_at(10));  // Heat gun
+  TEST_ASSERT_EQUAL(alert_final_sec, alert_final_at(30));
+  TEST_ASSERT_EQUAL(0, alert_final_at(1));  // Too short for both
+
+  for (uint16_t warning_sec = 1; warning_sec <= 255; warning_sec++)
+    TEST_ASSERT_LESS_THAN(warning_sec, alert_final_at(warning_sec));
+}
+
+/*
+  Count the last seconds of a profile down on a virtual clock, pushing alerts as loop()
+  does, and check both alerts play in full with the warning first
+*/
+void test_profiles_play_warning_then_final(void) {
+  for (uint8_t n = 0; n < max_profiles; n++) {
+    const timer_profile& p = default_profiles[n];
+    setUp();
+
+    uint32_t warning_start = 0;
+    uint32_t final_start = 0;
+    uint8_t warnings_done = 0;
+    uint8_t finals_done = 0;
+    uint32_t now_ms = 0;
+
+    for (uint32_t timer = p.warning_sec + 3; timer > 0; timer--) {
+      if (timer == p.warning_sec)
+        alert_push(q, &warning);
+      if (timer == alert_final_at(p.warning_sec))
+        alert_push(q, &final_alert);
+
+      // One second of loop() passes
+      for (uint16_t ms = 0; ms < 1000; ms += 10, now_ms += 10) {
+        alert_step step;
+        const alert_def* finished;
+        if (alert_service(q, now_ms, step, finished) == ALERT_ACT_STEP && q.step == 0) {
+          if (q.current == &warning) warning_start = now_ms;
+          if (q.current == &final_alert) final_start = now_ms;
+        }
+        if (finished == &warning) warnings_done++;
+        if (finished == &final_alert) finals_done++;
+      }
+    }
+
+    TEST_ASSERT_EQUAL_MESSAGE(1, warnings_done, p.name);
+    TEST_ASSERT_EQUAL_MESSAGE(1, finals_done, p.name);
+    TEST_ASSERT_LESS_THAN_MESSAGE(final_start, warning_start, p.name);
+  }
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_higher_priority_cuts_in);
+  RUN_TEST(test_equal_priority_waits);
+  RUN_TEST(test_feedback_dropped_while_playing);
+  RUN_TEST(test_duplicate_ignored);
+  RUN_TEST(test_full_queue_drops_lowest);
+  RUN_TEST(test_final_never_before_warning);
+  RUN_TEST(test_profiles_play_warning_then_final);
+  return UNITY_END();
+}
@@ -0,0 +1,126 @@
+/*
+  test_binlog
+
+  Description:
+  ------------
+  * binlog_format() gives the same text as printf would for integer, float and string
+    arguments, in the log_x() layout, and never writes past the buffer
+  * String arguments are copied, and cut short when the record's text space runs out
+  * The ring keeps records in order and counts the ones dropped when it is full
+  * The blog_x() macros keep info and below by default, whatever CORE_DEBUG_LEVEL is
+*/
+#include <unity.h>
+
+#include "binlog.h"
+
+binlog_ring binlog_main;
+uint32_t binlog_now_ms() {
+  return 42;
+}
+
+static binlog_ring& ring = binlog_main;
+static binlog_rec rec;
+static char out[160];
+
+// Write one record and format it straight back
+template <typename... Args>
+static const char* roundtrip(uint8_t level, const char* fmt, Args... args) {
+  TEST_ASSERT_TRUE(binlog_write(ring, 1234, level, fmt, args...));
+  TEST_ASSERT_TRUE(binlog_read(ring, rec));
+  binlog_format(rec, out, sizeof(out));
+  return out;
+}
+
+void setUp(void) {
+  ring.head = 0;
+  ring.tail = 0;
+  ring.dropped = 0;
+}
+
+void tearDown(void) {
+}
+
+void test_integers(void) {
+  TEST_ASSERT_EQUAL_STRING("[  1234][I] MQTT rc=-2 port 1883 id 0x00ff",
+                           roundtrip(binlog_level_info, "MQTT rc=%d port %u id 0x%04x", -2, 1883, 255));
+  TEST_ASSERT_EQUAL_STRING("[  1234][W] 4000000000 ms, 7 left, 100%",
+                           roundtrip(binlog_level_warn, "%lu ms, %hu left, 100%%", 4000000000UL, (uint16_t)7));
+}
+
+void test_floats(void) {
+  TEST_ASSERT_EQUAL_STRING("[  1234][D] 0.0556 mAh, avg 200.0 mA",
+                           roundtrip(binlog_level_debug, "%.4f mAh, avg %.1f mA", 0.0556f, 200.0));
+}
+
+void test_strings_are_copied(void) {
+  char topic[16] = "iron/cmd";
+  TEST_ASSERT_TRUE(binlog_write(ring, 5, binlog_level_error, "[%s] %s", topic, "on"));
+  strcpy(topic, "changed");  // The stack buffer is reused before the drain task gets to it
+  TEST_ASSERT_TRUE(binlog_read(ring, rec));
+  binlog_format(rec, out, sizeof(out));
+  TEST_ASSERT_EQUAL_STRING("[     5][E] [iron/cmd] on", out);
+}
+
+void test_long_strings_are_cut_short(void) {
+  const char* long_text = "0123456789012345678901234567890123456789012345678901234567890123456789";
+  roundtrip(binlog_level_info, "%s|%s", long_text, "tail");
+  // The first string fills the record's text space, the second gets what is left, if anything
+  TEST_ASSERT_EQUAL(binlog_text_len - 1, strchr(out, '|') - strstr(out, "0123"));
+  TEST_ASSERT_TRUE(strlen(out) < sizeof(out));
+}
+
+void test_missing_args_print_zero(void) {
+  TEST_ASSERT_EQUAL_STRING("[  1234][V] 1 2 3 4 5 6 0",
+                           roundtrip(binlog_level_verbose, "%u %u %u %u %u %u %u", 1, 2, 3, 4, 5, 6, 7));
+}
+
+void test_output_is_truncated_to_the_buffer(void) {
+  char small[20];
+  TEST_ASSERT_TRUE(binlog_write(ring, 1234, binlog_level_info, "Connected to %s:%u", "192.168.20.2", 1883));
+  TEST_ASSERT_TRUE(binlog_read(ring, rec));
+  size_t n = binlog_format(rec, small, sizeof(small));
+  TEST_ASSERT_EQUAL(sizeof(small) - 1, n);
+  TEST_ASSERT_EQUAL_STRING("[  1234][I] Connect", small);
+}
+
+void test_ring_order_and_drops(void) {
+  for (uint32_t i = 0; i < binlog_ring_len; i++)
+    TEST_ASSERT_TRUE(binlog_write(ring, i, binlog_level_info, "n=%u", i));
+  TEST_ASSERT_FALSE(binlog_write(ring, 0, binlog_level_info, "lost"));
+  TEST_ASSERT_EQUAL(1, ring.dropped.load());
+
+  for (uint32_t i = 0; i < binlog_ring_len; i++) {
+    TEST_ASSERT_TRUE(binlog_read(ring, rec));
+    TEST_ASSERT_EQUAL(i, rec.ms);
+    TEST_ASSERT_EQUAL(i, rec.args[0]);
+  }
+  TEST_ASSERT_TRUE(binlog_empty(ring));
+  TEST_ASSERT_FALSE(binlog_read(ring, rec));
+}
+
+void test_default_level_is_info(void) {
+  blog_e("e");
+  blog_w("w");
+  blog_i("i=%u", 3);
+  blog_d("d");
+  blog_v("v");
+  for (uint8_t level = binlog_level_error; level <= binlog_level_info; level++) {
+    TEST_ASSERT_TRUE(binlog_read(ring, rec));
+    TEST_ASSERT_EQUAL(level, rec.level);
+    TEST_ASSERT_EQUAL(42, rec.ms);
+  }
+  TEST_ASSERT_TRUE(binlog_empty(ring));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_integers);
+  RUN_TEST(test_floats);
+  RUN_TEST(test_strings_are_copied);
+  RUN_TEST(test_long_strings_are_cut_short);
+  RUN_TEST(test_missing_args_print_zero);
+  RUN_TEST(test_output_is_truncated_to_the_buffer);
+  RUN_TEST(test_ring_order_and_drops);
+  RUN_TEST(test_default_level_is_info);
+  return UNITY_END();
+}
@@ -0,0 +1,290 @@
+/*
+  test_broker_list
+
+  Description:
+  ------------
+  * broker_pick() and broker_report(): health order, sticky preference, back off
+  * broker_race against two broker stand-ins listening on localhost. The preferred one
+    is killed mid-session and the client has to fail over to the other without
+    blocking, then stay there when the first comes back
+  * A broker that accepts the TCP connect but refuses MQTT is not counted as good, and
+    backs off so the other broker is tried next
+*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <unity.h>
+
+#include "broker_list.h"
+#include "broker_race.h"
+
+#define test_timeout_ms 300
+#define test_poll_ms    5
+
+static mqtt_broker brokers[2];
+static broker_list list;
+
+static uint32_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void sleep_ms(uint32_t ms) {
+  struct timespec ts = {0, (long)ms * 1000000};
+  nanosleep(&ts, nullptr);
+}
+
+// A broker stand-in, only has to accept TCP connections
+static int listen_on(uint16_t& port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  TEST_ASSERT_EQUAL(0, bind(fd, (struct sockaddr*)&addr, sizeof(addr)));
+  TEST_ASSERT_EQUAL(0, listen(fd, 4));
+
+  socklen_t len = sizeof(addr);
+  getsockname(fd, (struct sockaddr*)&addr, &len);
+  port = ntohs(addr.sin_port);
+  return fd;
+}
+
+// Poll the race as loop() would until it connects, or give up
+static broker_race_result race_until_connected(broker_race& race, int& fd, uint8_t& idx, uint32_t limit_ms, uint32_t& max_poll_us) {
+  uint32_t start = now_ms();
+  broker_race_result r = RACE_IDLE;
+
+  while (now_ms() - start < limit_ms) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    r = broker_race_poll(race, list, now_ms(), test_timeout_ms, fd, idx);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    uint32_t us = (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000;
+    if (us > max_poll_us) max_poll_us = us;
+    if (r == RACE_CONNECTED) break;
+    sleep_ms(test_poll_ms);
+  }
+  return r;
+}
+
+void setUp(void) {
+  memset(brokers, 0, sizeof(brokers));
+  brokers[0].ip = htonl(INADDR_LOOPBACK);
+  brokers[1].ip = htonl(INADDR_LOOPBACK);
+  list = {brokers, 2, broker_no_pick};
+}
+
+void tearDown(void) {
+}
+
+void test_pick_prefers_list_order_then_health(void) {
+  TEST_ASSERT_EQUAL(0, broker_pick(list, 0));
+
+  // A slow first broker loses to a fast second one
+  broker_report(list, 0, true, 800, 0);
+  broker_report(list, 1, true, 20, 0);
+  TEST_ASSERT_EQUAL(1, broker_pick(list, 0));
+}
+
+void test_sticky_to_last_good(void) {
+  broker_report(list, 0, true, 100, 0);
+  broker_report(list, 1, true, 400, 0);  // Slower, but connected last
+  TEST_ASSERT_EQUAL(1, broker_pick(list, 0));
+}
+
+void test_failure_backs_off(void) {
+  broker_report(list, 0, false, 0, 1000);
+  TEST_ASSERT_EQUAL(1, broker_pick(list, 1000));
+  TEST_ASSERT_EQUAL(1000 + 1000, brokers[0].retry_at_ms);
+
+  broker_report(list, 1, false, 0, 1000);
+  TEST_ASSERT_EQUAL(broker_no_pick, broker_pick(list, 1500));
+  TEST_ASSERT_EQUAL(0, broker_pick(list, 2000));  // Both backing off the same, list order decides
+
+  // Doubles each time, up to the limit
+  for (uint8_t i = 0; i < 10; i++)
+    broker_report(list, 0, false, 0, 5000);
+  TEST_ASSERT_EQUAL(5000 + broker_max_backoff_ms, brokers[0].retry_at_ms);
+
+  // One success clears it
+  broker_report(list, 0, true, 50, 6000);
+  TEST_ASSERT_EQUAL(0, brokers[0].failures);
+  TEST_ASSERT_EQUAL(0, broker_pick(list, 6000));
+}
+
+void test_pick_except(void) {
+  TEST_ASSERT_EQUAL(1, broker_pick_except(list, 0, 1UL << 0));
+  TEST_ASSERT_EQUAL(broker_no_pick, broker_pick_except(list, 0, 3));
+}
+
+void test_unreachable_broker_times_out(void) {
+  broker_race race;
+  broker_race_init(race);
+  brokers[0].ip = inet_addr("192.0.2.1");  // TEST-NET-1, never answers (or no route here)
+  brokers[0].port = 1883;
+  list.count = 1;
+
+  int fd = -1;
+  uint8_t idx = broker_no_pick;
+  uint32_t max_poll_us = 0;
+  TEST_ASSERT_NOT_EQUAL(RACE_CONNECTED, race_until_connected(race, fd, idx, test_timeout_ms + 100, max_poll_us));
+  TEST_ASSERT_EQUAL(1, brokers[0].failures);
+  TEST_ASSERT_LESS_THAN(10000, max_poll_us);  // Each poll is a check, not a wait
+  broker_race_abort(race);
+}
+
+void test_slow_broker_raced(void) {
+  // The preferred broker never answers, the second one is started after the stagger and wins
+  uint16_t port_b = 0;
+  int listen_b = listen_on(port_b);
+  brokers[0].ip = inet_addr("192.0.2.1");
+  brokers[0].port = 1883;
+  brokers[1].port = port_b;
+
+  broker_race race;
+  broker_race_init(race);
+  int fd = -1;
+  uint8_t idx = broker_no_pick;
+  uint32_t max_poll_us = 0;
+  uint32_t start = now_ms();
+
+  TEST_ASSERT_EQUAL(RACE_CONNECTED, race_until_connected(race, fd, idx, 1000, max_poll_us));
+  broker_race_done(race, list, true, now_ms());  // As reconnect() does once the CONNACK is in
+  TEST_ASSERT_EQUAL(1, idx);
+  TEST_ASSERT_LESS_THAN(test_timeout_ms, now_ms() - start);
+  TEST_ASSERT_EQUAL(1, list.last_good);
+  for (uint8_t i = 0; i < broker_race_len; i++)
+    TEST_ASSERT_EQUAL(-1, race.attempts[i].fd);  // The loser was closed
+  close(fd);
+  close(listen_b);
+}
+
+void test_failover_when_broker_killed_mid_session(void) {
+  uint16_t port_a = 0;
+  uint16_t port_b = 0;
+  int listen_a = listen_on(port_a);
+  int listen_b = listen_on(port_b);
+  brokers[0].port = port_a;
+  brokers[1].port = port_b;
+
+  broker_race race;
+  broker_race_init(race);
+  int fd = -1;
+  uint8_t idx = broker_no_pick;
+  uint32_t max_poll_us = 0;
+
+  // Both up, the first in the list wins
+  TEST_ASSERT_EQUAL(RACE_CONNECTED, race_until_connected(race, fd, idx, 1000, max_poll_us));
+  broker_race_done(race, list, true, now_ms());
+  TEST_ASSERT_EQUAL(0, idx);
+  TEST_ASSERT_EQUAL(0, list.last_good);
+  int session = accept(listen_a, nullptr, nullptr);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, session);
+
+  // Kill broker A mid-session: the client sees the connection close
+  close(session);
+  close(listen_a);
+  char byte;
+  TEST_ASSERT_EQUAL(0, recv(fd, &byte, 1, 0));
+  close(fd);
+
+  // A now refuses, B takes over without waiting for A's timeout
+  uint32_t start = now_ms();
+  fd = -1;
+  TEST_ASSERT_EQUAL(RACE_CONNECTED, race_until_connected(race, fd, idx, 1000, max_poll_us));
+  broker_race_done(race, list, true, now_ms());
+  uint32_t failover_ms = now_ms() - start;
+  TEST_ASSERT_EQUAL(1, idx);
+  TEST_ASSERT_EQUAL(1, brokers[0].failures);
+  TEST_ASSERT_LESS_THAN(test_timeout_ms, failover_ms);
+  close(fd);
+
+  // A comes back, once its back off is over the client still sticks with B
+  listen_a = listen_on(port_a);
+  sleep_ms(1100);
+  fd = -1;
+  TEST_ASSERT_EQUAL(RACE_CONNECTED, race_until_connected(race, fd, idx, 1000, max_poll_us));
+  broker_race_done(race, list, true, now_ms());
+  TEST_ASSERT_EQUAL(1, idx);
+  close(fd);
+
+  // B is killed too, back to A
+  close(listen_b);
+  fd = -1;
+  TEST_ASSERT_EQUAL(RACE_CONNECTED, race_until_connected(race, fd, idx, 1000, max_poll_us));
+  broker_race_done(race, list, true, now_ms());
+  TEST_ASSERT_EQUAL(0, idx);
+  close(fd);
+  close(listen_a);
+
+  TEST_ASSERT_LESS_THAN(10000, max_poll_us);
+
+  char msg[80];
+  snprintf(msg, sizeof(msg), "Failover %u ms, longest poll %u us", (unsigned)failover_ms, (unsigned)max_poll_us);
+  TEST_MESSAGE(msg);
+}
+
+void test_tcp_ok_but_mqtt_refused(void) {
+  uint16_t port_a = 0;
+  uint16_t port_b = 0;
+  int listen_a = listen_on(port_a);
+  int listen_b = listen_on(port_b);
+  brokers[0].port = port_a;
+  brokers[1].port = port_b;
+
+  broker_race race;
+  broker_race_init(race);
+  int fd = -1;
+  uint8_t idx = broker_no_pick;
+  uint32_t max_poll_us = 0;
+
+  // A accepts the TCP connect, which alone says nothing about MQTT
+  TEST_ASSERT_EQUAL(RACE_CONNECTED, race_until_connected(race, fd, idx, 1000, max_poll_us));
+  TEST_ASSERT_EQUAL(0, idx);
+  TEST_ASSERT_EQUAL(0, race.winner);
+  TEST_ASSERT_EQUAL(broker_no_pick, list.last_good);
+  TEST_ASSERT_EQUAL(0, brokers[0].connect_ms);
+
+  // Then refuses the CONNECT, e.g. bad credentials
+  close(fd);
+  broker_race_done(race, list, false, now_ms());
+  TEST_ASSERT_EQUAL(broker_no_pick, race.winner);
+  TEST_ASSERT_EQUAL(broker_no_pick, list.last_good);
+  TEST_ASSERT_EQUAL(1, brokers[0].failures);
+  TEST_ASSERT_EQUAL(0, broker_race_done(race, list, false, now_ms()));  // Reported once only
+  TEST_ASSERT_EQUAL(1, brokers[0].failures);
+
+  // A is backing off, so B is next and becomes last_good once it accepts MQTT
+  fd = -1;
+  TEST_ASSERT_EQUAL(RACE_CONNECTED, race_until_connected(race, fd, idx, 1000, max_poll_us));
+  TEST_ASSERT_EQUAL(1, idx);
+  broker_race_done(race, list, true, now_ms());
+  TEST_ASSERT_EQUAL(1, list.last_good);
+  TEST_ASSERT_EQUAL(0, brokers[1].failures);
+  close(fd);
+  close(listen_a);
+  close(listen_b);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_pick_prefers_list_order_then_health);
+  RUN_TEST(test_sticky_to_last_good);
+  RUN_TEST(test_failure_backs_off);
+  RUN_TEST(test_pick_except);
+  RUN_TEST(test_unreachable_broker_times_out);
+  RUN_TEST(test_slow_broker_raced);
+  RUN_TEST(test_failover_when_broker_killed_mid_session);
+  RUN_TEST(test_tcp_ok_but_mqtt_refused);
+  return UNITY_END();
+}
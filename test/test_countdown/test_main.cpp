@@ -0,0 +1,303 @@
+/*
+  test_countdown
+
+  Description:
+  ------------
+  * Soak test of the count down and shutdown path against a virtual clock
+  * Each cycle sets a timer and runs loop() iterations of random length, with button,
+    touch and MQTT events and MQTT outages scripted at random times, until the timer
+    expires. Thousands of cycles run in well under a second
+  * Checks every cycle that shutdown happens inside its deadline, that "Off" is
+    published before sleep (and still attempted during an outage), and that only the
+    scripted stalls go over the loop budget
+*/
+#include <stdio.h>
+#include <unity.h>
+
+#include "countdown.h"
+#include "timer_profiles.h"
+
+#define soak_cycles       3000
+#define soak_max_timer    120    // Longest timer set at the start of a cycle, seconds
+#define soak_max_events   8      // Scripted events per cycle
+#define soak_loop_min_ms  1      // Normal loop() iteration
+#define soak_loop_max_ms  30
+#define soak_stall_ms     80     // A scripted stall, over budget
+#define soak_budget_ms    50     // Same as loop_budget_us in main.cpp
+
+enum soak_event_kind : uint8_t {
+  EV_BUTTON_SHORTER = 0,
+  EV_BUTTON_LONGER,
+  EV_BUTTON_LONGPRESS,
+  EV_TOUCH,
+  EV_MQTT_EXTEND,
+  EV_OUTAGE_START,
+  EV_OUTAGE_END,
+  EV_STALL,
+  EV_KIND_COUNT,
+};
+
+struct soak_event {
+  uint32_t at_ms;
+  soak_event_kind kind;
+  uint8_t arg;
+};
+
+// What the shutdown steps saw, in call order
+enum shutdown_call : uint8_t { CALL_PUBLISH_OFF = 1, CALL_SAVE, CALL_DISPLAY, CALL_SLEEP };
+
+static uint32_t rng_state;
+static bool mqtt_up;
+static shutdown_call calls[8];
+static uint8_t call_count;
+static uint32_t off_sent;
+
+static uint32_t rng_next() {
+  // xorshift32, so every run replays the same script
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static uint32_t rng_range(uint32_t lo, uint32_t hi) {
+  return lo + rng_next() % (hi - lo + 1);
+}
+
+static void record(shutdown_call c) {
+  if (call_count < sizeof(calls)) calls[call_count++] = c;
+}
+
+static bool sim_publish_off() {
+  record(CALL_PUBLISH_OFF);
+  if (mqtt_up) off_sent++;
+  return mqtt_up;
+}
+static void sim_save_state() { record(CALL_SAVE); }
+static void sim_display_off() { record(CALL_DISPLAY); }
+static void sim_sleep() { record(CALL_SLEEP); }
+
+static const shutdown_steps sim_steps = {sim_publish_off, sim_save_state, sim_display_off, sim_sleep};
+
+struct soak_totals {
+  uint32_t cycles;
+  uint64_t iterations;
+  uint64_t virtual_ms;
+  uint32_t events;
+  uint32_t stalls;
+  uint32_t outage_shutdowns;
+  uint32_t max_late_ms;  // Shutdown after the nominal set time + timer, worst case
+  loop_stats loops;  // In ms rather than us, so hours of virtual time don't overflow
+};
+
+void setUp(void) {
+  rng_state = 0x1ce7u;
+  mqtt_up = true;
+  call_count = 0;
+  off_sent = 0;
+}
+
+void tearDown(void) {
+}
+
+// One full cycle: set a timer, run loop() iterations until it expires
+static void soak_cycle(soak_totals& totals, uint32_t& now_ms) {
+  const timer_profile& prof = default_profiles[rng_next() % max_profiles];
+  uint32_t timer = rng_range(0, soak_max_timer);
+  uint32_t last_tick = now_ms - rng_range(0, countdown_tick_ms);  // Mid-way through a tick, as after a wake
+  uint32_t start_ms = now_ms;
+  uint32_t set_ms = now_ms;
+  uint32_t set_value = timer;
+
+  // Script the events over the time the timer would run, some land after expiry and never fire
+  soak_event script[soak_max_events];
+  uint8_t n_events = rng_range(0, soak_max_events);
+  for (uint8_t i = 0; i < n_events; i++) {
+    script[i].at_ms = now_ms + rng_range(0, (timer + 2) * countdown_tick_ms);
+    script[i].kind = (soak_event_kind)(rng_next() % EV_KIND_COUNT);
+    script[i].arg = rng_range(0, 100);
+  }
+  for (uint8_t i = 1; i < n_events; i++)
+    for (uint8_t j = i; j > 0 && (int32_t)(script[j].at_ms - script[j - 1].at_ms) < 0; j--) {
+      soak_event t = script[j];
+      script[j] = script[j - 1];
+      script[j - 1] = t;
+    }
+
+  uint8_t next_event = 0;
+  call_count = 0;
+  mqtt_up = true;
+
+  for (;;) {
+    uint32_t iter_ms = rng_range(soak_loop_min_ms, soak_loop_max_ms);
+
+    while (next_event < n_events && (int32_t)(now_ms - script[next_event].at_ms) >= 0) {
+      const soak_event& ev = script[next_event++];
+      bool changed = true;
+      totals.events++;
+      switch (ev.kind) {
+        case EV_BUTTON_SHORTER:
+          timer = countdown_shorter(timer, prof.step_sec);
+          break;
+        case EV_BUTTON_LONGER:
+        case EV_MQTT_EXTEND:
+          timer = countdown_longer(timer, prof.step_sec);
+          break;
+        case EV_BUTTON_LONGPRESS:
+          if (timer >= countdown_min_sec) timer = countdown_min_sec;
+          break;
+        case EV_TOUCH:
+          timer = countdown_from_percent(ev.arg, prof.duration_sec);
+          break;
+        case EV_OUTAGE_START:
+          mqtt_up = false;
+          changed = false;
+          break;
+        case EV_OUTAGE_END:
+          mqtt_up = true;
+          changed = false;
+          break;
+        case EV_STALL:
+          iter_ms = soak_stall_ms;
+          totals.stalls++;
+          changed = false;
+          break;
+        default:
+          changed = false;
+          break;
+      }
+      if (changed) {
+        set_ms = now_ms;
+        set_value = timer;
+      }
+    }
+
+    countdown_event event = countdown_step(timer, last_tick, now_ms);
+    if (event == COUNTDOWN_EXPIRED) {
+      bool outage = !mqtt_up;
+      TEST_ASSERT_EQUAL_MESSAGE(mqtt_up, countdown_shutdown(sim_steps), "publish result");
+
+      // Every step ran once, "Off" first and sleep last
+      TEST_ASSERT_EQUAL(4, call_count);
+      TEST_ASSERT_EQUAL(CALL_PUBLISH_OFF, calls[0]);
+      TEST_ASSERT_EQUAL(CALL_SLEEP, calls[3]);
+
+      // One tick per second of the last setting, plus the 0:00 tick. The tick grid
+      // doesn't move when the timer is changed, so the first tick can come straight
+      // away; lateness doesn't add up, so the deadline is a second and one iteration
+      // past the setting at most
+      uint32_t ran_ms = now_ms - set_ms;
+      TEST_ASSERT_GREATER_OR_EQUAL_UINT32(set_value * countdown_tick_ms, ran_ms + soak_stall_ms);
+      TEST_ASSERT_LESS_OR_EQUAL_UINT32((set_value + 1) * countdown_tick_ms + soak_stall_ms, ran_ms);
+
+      if (ran_ms > set_value * countdown_tick_ms && ran_ms - set_value * countdown_tick_ms > totals.max_late_ms)
+        totals.max_late_ms = ran_ms - set_value * countdown_tick_ms;
+      if (outage) totals.outage_shutdowns++;
+      break;
+    }
+    TEST_ASSERT_EQUAL(0, call_count);  // No shutdown step before expiry
+
+    loop_stats_add(totals.loops, iter_ms, soak_budget_ms);
+    totals.iterations++;
+    now_ms += iter_ms;
+  }
+
+  totals.cycles++;
+  totals.virtual_ms += now_ms - start_ms;
+}
+
+void test_countdown_step_ticks_once_per_second(void) {
+  uint32_t remaining = 2;
+  uint32_t last = 0;
+
+  TEST_ASSERT_EQUAL(COUNTDOWN_IDLE, countdown_step(remaining, last, 1000));
+  TEST_ASSERT_EQUAL(COUNTDOWN_TICK, countdown_step(remaining, last, 1001));
+  TEST_ASSERT_EQUAL(1, remaining);
+  TEST_ASSERT_EQUAL(COUNTDOWN_IDLE, countdown_step(remaining, last, 2000));
+  TEST_ASSERT_EQUAL(COUNTDOWN_TICK, countdown_step(remaining, last, 2001));
+  TEST_ASSERT_EQUAL(0, remaining);
+  TEST_ASSERT_EQUAL(COUNTDOWN_IDLE, countdown_step(remaining, last, 3000));
+  TEST_ASSERT_EQUAL(COUNTDOWN_EXPIRED, countdown_step(remaining, last, 3001));
+}
+
+void test_countdown_step_late_ticks_dont_add_up(void) {
+  uint32_t remaining = 100;
+  uint32_t last = 0;
+
+  // Every tick 40 ms late, the grid holds
+  for (uint32_t s = 1; s <= 50; s++)
+    TEST_ASSERT_EQUAL(COUNTDOWN_TICK, countdown_step(remaining, last, s * countdown_tick_ms + 40));
+  TEST_ASSERT_EQUAL(50 * countdown_tick_ms, last);
+
+  // A stall of several seconds is one tick, not a burst
+  TEST_ASSERT_EQUAL(COUNTDOWN_TICK, countdown_step(remaining, last, 55500));
+  TEST_ASSERT_EQUAL(COUNTDOWN_IDLE, countdown_step(remaining, last, 55600));
+  TEST_ASSERT_EQUAL(49, remaining);
+  TEST_ASSERT_EQUAL(COUNTDOWN_TICK, countdown_step(remaining, last, 56501));
+}
+
+void test_countdown_step_across_millis_wrap(void) {
+  uint32_t remaining = 1;
+  uint32_t last = 0xFFFFFF00u;
+
+  TEST_ASSERT_EQUAL(COUNTDOWN_IDLE, countdown_step(remaining, last, 0x000002E8u));
+  TEST_ASSERT_EQUAL(COUNTDOWN_TICK, countdown_step(remaining, last, 0x000002E9u));
+  TEST_ASSERT_EQUAL(0, remaining);
+}
+
+void test_countdown_adjust(void) {
+  TEST_ASSERT_EQUAL(180, countdown_shorter(300, 120));
+  TEST_ASSERT_EQUAL(countdown_min_sec, countdown_shorter(124, 120));
+  TEST_ASSERT_EQUAL(countdown_min_sec, countdown_shorter(0, 120));
+  TEST_ASSERT_EQUAL(420, countdown_longer(300, 120));
+  TEST_ASSERT_EQUAL(countdown_max_sec, countdown_longer(countdown_max_sec - 120, 120));
+  TEST_ASSERT_EQUAL(countdown_max_sec, countdown_longer(countdown_max_sec - 1, 120));
+  TEST_ASSERT_EQUAL(0, countdown_from_percent(0, 1800));
+  TEST_ASSERT_EQUAL(900, countdown_from_percent(50, 1800));
+  TEST_ASSERT_EQUAL(1800, countdown_from_percent(100, 1800));
+}
+
+void test_shutdown_publishes_off_during_outage(void) {
+  mqtt_up = false;
+  TEST_ASSERT_FALSE(countdown_shutdown(sim_steps));
+  TEST_ASSERT_EQUAL(4, call_count);
+  TEST_ASSERT_EQUAL(CALL_PUBLISH_OFF, calls[0]);
+  TEST_ASSERT_EQUAL(CALL_SAVE, calls[1]);
+  TEST_ASSERT_EQUAL(CALL_DISPLAY, calls[2]);
+  TEST_ASSERT_EQUAL(CALL_SLEEP, calls[3]);
+  TEST_ASSERT_EQUAL(0, off_sent);
+}
+
+void test_soak(void) {
+  soak_totals totals = {};
+  uint32_t now_ms = 0xFFF00000u;  // Wraps millis() a few cycles in
+
+  for (uint32_t i = 0; i < soak_cycles; i++)
+    soak_cycle(totals, now_ms);
+
+  TEST_ASSERT_EQUAL(soak_cycles, totals.cycles);
+  TEST_ASSERT_EQUAL(soak_cycles - totals.outage_shutdowns, off_sent);
+  TEST_ASSERT_GREATER_THAN(0, totals.outage_shutdowns);
+  TEST_ASSERT_EQUAL(totals.stalls, totals.loops.over_budget);
+
+  char msg[200];
+  snprintf(msg, sizeof(msg), "%u cycles, %llu iterations, %.1f virtual hours, %u events, %u shutdowns during an outage",
+           (unsigned)totals.cycles, (unsigned long long)totals.iterations, totals.virtual_ms / 3600000.0,
+           (unsigned)totals.events, (unsigned)totals.outage_shutdowns);
+  TEST_MESSAGE(msg);
+  snprintf(msg, sizeof(msg), "Loop avg %u ms, max %u ms, %u over budget. Shutdown at most %u ms after nominal",
+           (unsigned)loop_stats_avg_us(totals.loops), (unsigned)totals.loops.max_us,
+           (unsigned)totals.loops.over_budget, (unsigned)totals.max_late_ms);
+  TEST_MESSAGE(msg);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_countdown_step_ticks_once_per_second);
+  RUN_TEST(test_countdown_step_late_ticks_dont_add_up);
+  RUN_TEST(test_countdown_step_across_millis_wrap);
+  RUN_TEST(test_countdown_adjust);
+  RUN_TEST(test_shutdown_publishes_off_during_outage);
+  RUN_TEST(test_soak);
+  return UNITY_END();
+}
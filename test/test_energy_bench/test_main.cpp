@@ -0,0 +1,113 @@
+/*
+  test_energy_bench
+
+  Description:
+  ------------
+  * energy_add() integrates with the trapezoid rule, clamps negative samples and keeps
+    the peak
+  * The scenarios run in order and the run finishes after the last one
+  * bench_report_json() writes one line with the figures of the current scenario
+*/
+#include <string.h>
+#include <unity.h>
+
+#include "energy_bench.h"
+
+static bench_run run;
+
+void setUp(void) {
+  bench_start(run, 1000);
+}
+
+void tearDown(void) {
+}
+
+void test_first_sample_only_sets_the_start(void) {
+  energy_add(run.acc, 150, 1000);
+  TEST_ASSERT_EQUAL(1, run.acc.samples);
+  TEST_ASSERT_EQUAL(0, run.acc.elapsed_ms);
+  TEST_ASSERT_EQUAL(0, (uint32_t)run.acc.ma_ms);
+  // No interval yet, the average is the one sample
+  TEST_ASSERT_EQUAL_FLOAT(150, energy_avg_ma(run.acc));
+}
+
+void test_trapezoid_integration(void) {
+  // Ramp from 100 to 200 mA over 100 ms, then flat at 200 mA for 100 ms
+  energy_add(run.acc, 100, 0);
+  energy_add(run.acc, 200, 100);
+  energy_add(run.acc, 200, 200);
+  TEST_ASSERT_EQUAL(15000 + 20000, (uint32_t)run.acc.ma_ms);
+  TEST_ASSERT_EQUAL(200, run.acc.elapsed_ms);
+  TEST_ASSERT_EQUAL_FLOAT(175, energy_avg_ma(run.acc));
+  TEST_ASSERT_EQUAL_FLOAT(200, run.acc.max_ma);
+}
+
+void test_one_hour_at_100ma_is_100mah(void) {
+  for (uint32_t t = 0; t <= 3600000; t += bench_sample_ms)
+    energy_add(run.acc, 100, t);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 100, energy_mah(run.acc));
+}
+
+void test_negative_current_is_clamped(void) {
+  // Charging shows up as negative discharge current
+  energy_add(run.acc, -50, 0);
+  energy_add(run.acc, 100, 100);
+  TEST_ASSERT_EQUAL(5000, (uint32_t)run.acc.ma_ms);
+  TEST_ASSERT_EQUAL_FLOAT(100, run.acc.max_ma);
+}
+
+void test_scenarios_run_in_order(void) {
+  TEST_ASSERT_TRUE(run.active);
+  TEST_ASSERT_EQUAL(BENCH_IDLE, run.scenario);
+  TEST_ASSERT_FALSE(bench_scenario_done(run, 1000 + bench_scenario_ms - 1));
+  TEST_ASSERT_TRUE(bench_scenario_done(run, 1000 + bench_scenario_ms));
+
+  uint32_t now = 1000;
+  for (uint8_t s = 1; s < BENCH_COUNT; s++) {
+    energy_add(run.acc, 100, now);
+    now += bench_scenario_ms;
+    TEST_ASSERT_TRUE(bench_next(run, now));
+    TEST_ASSERT_EQUAL(s, run.scenario);
+    TEST_ASSERT_EQUAL(now, run.start_ms);
+    TEST_ASSERT_EQUAL(0, run.acc.samples);  // Each scenario starts with a clear accumulator
+  }
+  TEST_ASSERT_FALSE(bench_next(run, now + bench_scenario_ms));
+  TEST_ASSERT_FALSE(run.active);
+  TEST_ASSERT_FALSE(bench_scenario_done(run, now + 2 * bench_scenario_ms));
+}
+
+void test_bar_is_left_to_touch_and_ota(void) {
+  for (uint8_t s = 0; s < BENCH_COUNT; s++) {
+    run.scenario = (bench_scenario)s;
+    TEST_ASSERT_EQUAL(s == BENCH_TOUCH || s == BENCH_OTA, bench_drives_bar(run));
+  }
+  run.active = false;
+  run.scenario = BENCH_TOUCH;
+  TEST_ASSERT_FALSE(bench_drives_bar(run));
+}
+
+void test_report_json(void) {
+  char json[200];
+
+  run.scenario = BENCH_RECONNECT;
+  energy_add(run.acc, 100, 0);
+  energy_add(run.acc, 300, 1000);
+  int len = bench_report_json(json, sizeof(json), run, "1.2", true);
+  TEST_ASSERT_EQUAL(strlen(json), len);
+  TEST_ASSERT_EQUAL_STRING(
+      "{\"fw\":\"1.2\",\"scenario\":\"reconnect\",\"ms\":1000,\"samples\":2,"
+      "\"mah\":0.0556,\"avg_ma\":200.0,\"max_ma\":300.0,\"on_battery\":true}",
+      json);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_sample_only_sets_the_start);
+  RUN_TEST(test_trapezoid_integration);
+  RUN_TEST(test_one_hour_at_100ma_is_100mah);
+  RUN_TEST(test_negative_current_is_clamped);
+  RUN_TEST(test_scenarios_run_in_order);
+  RUN_TEST(test_bar_is_left_to_touch_and_ota);
+  RUN_TEST(test_report_json);
+  return UNITY_END();
+}
@@ -0,0 +1,119 @@
+/*
+  test_frame_governor
+
+  Description:
+  ------------
+  * frame_gov_battery(): low battery sets below frame_low_batt_enter, stays set through
+    the gap (22 %) and clears only above frame_low_batt_exit, or on external power
+  * frame_gov_update(): active drops to normal after frame_active_hold_ms and to idle
+    after a further frame_normal_hold_ms, and activity starts it over
+  * The frame interval and backlight that follow from the mode and battery state
+*/
+#include <unity.h>
+
+#include "frame_governor.h"
+
+static frame_governor g;
+
+void setUp(void) {
+  frame_gov_init(g, 0);
+}
+
+void tearDown(void) {
+}
+
+void test_battery_hysteresis(void) {
+  frame_gov_battery(g, 22, false);
+  TEST_ASSERT_FALSE(g.low_batt);  // Inside the gap, coming from above
+
+  frame_gov_battery(g, frame_low_batt_enter, false);
+  TEST_ASSERT_FALSE(g.low_batt);
+  frame_gov_battery(g, frame_low_batt_enter - 1, false);
+  TEST_ASSERT_TRUE(g.low_batt);
+
+  // Recovering through the gap keeps it set
+  frame_gov_battery(g, 22, false);
+  TEST_ASSERT_TRUE(g.low_batt);
+  frame_gov_battery(g, frame_low_batt_exit, false);
+  TEST_ASSERT_TRUE(g.low_batt);
+  frame_gov_battery(g, frame_low_batt_exit + 1, false);
+  TEST_ASSERT_FALSE(g.low_batt);
+}
+
+void test_battery_noise_no_flapping(void) {
+  // A reading jumping around 22 % after going low never clears it
+  static const uint8_t readings[] = {19, 23, 21, 24, 22, 25, 20, 23};
+  for (uint8_t i = 0; i < sizeof(readings); i++) {
+    frame_gov_battery(g, readings[i], false);
+    TEST_ASSERT_TRUE(g.low_batt);
+  }
+}
+
+void test_external_power_clears_low(void) {
+  frame_gov_battery(g, 10, false);
+  TEST_ASSERT_TRUE(g.low_batt);
+  frame_gov_battery(g, 10, true);
+  TEST_ASSERT_FALSE(g.low_batt);
+}
+
+void test_mode_decay(void) {
+  frame_gov_activity(g, 1000);
+  TEST_ASSERT_EQUAL(FRAME_ACTIVE, g.mode);
+
+  frame_gov_update(g, 1000 + frame_active_hold_ms - 1);
+  TEST_ASSERT_EQUAL(FRAME_ACTIVE, g.mode);
+  frame_gov_update(g, 1000 + frame_active_hold_ms);
+  TEST_ASSERT_EQUAL(FRAME_NORMAL, g.mode);
+
+  frame_gov_update(g, 1000 + frame_active_hold_ms + frame_normal_hold_ms - 1);
+  TEST_ASSERT_EQUAL(FRAME_NORMAL, g.mode);
+  frame_gov_update(g, 1000 + frame_active_hold_ms + frame_normal_hold_ms);
+  TEST_ASSERT_EQUAL(FRAME_IDLE, g.mode);
+
+  // Activity goes straight back to active, from idle
+  frame_gov_activity(g, 20000);
+  frame_gov_update(g, 20000);
+  TEST_ASSERT_EQUAL(FRAME_ACTIVE, g.mode);
+}
+
+void test_mode_decay_from_normal(void) {
+  // After init there was no activity, normal holds until the idle time
+  frame_gov_update(g, frame_active_hold_ms);
+  TEST_ASSERT_EQUAL(FRAME_NORMAL, g.mode);
+  frame_gov_update(g, frame_active_hold_ms + frame_normal_hold_ms);
+  TEST_ASSERT_EQUAL(FRAME_IDLE, g.mode);
+}
+
+void test_mode_decay_across_millis_wrap(void) {
+  uint32_t start = 0xffffffff - 500;
+  frame_gov_activity(g, start);
+  frame_gov_update(g, start + frame_active_hold_ms);
+  TEST_ASSERT_EQUAL(FRAME_NORMAL, g.mode);
+  frame_gov_update(g, start + frame_active_hold_ms + frame_normal_hold_ms);
+  TEST_ASSERT_EQUAL(FRAME_IDLE, g.mode);
+}
+
+void test_interval_and_brightness(void) {
+  frame_gov_activity(g, 0);
+  TEST_ASSERT_EQUAL(frame_active_ms, frame_gov_interval_ms(g));
+  TEST_ASSERT_EQUAL(200, frame_gov_brightness(g, 200));
+
+  frame_gov_battery(g, 5, false);
+  TEST_ASSERT_EQUAL(2 * frame_active_ms, frame_gov_interval_ms(g));
+  TEST_ASSERT_EQUAL(200 * frame_dim_percent / 100, frame_gov_brightness(g, 200));
+
+  frame_gov_update(g, frame_active_hold_ms + frame_normal_hold_ms);
+  TEST_ASSERT_EQUAL(2 * frame_idle_ms, frame_gov_interval_ms(g));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_battery_hysteresis);
+  RUN_TEST(test_battery_noise_no_flapping);
+  RUN_TEST(test_external_power_clears_low);
+  RUN_TEST(test_mode_decay);
+  RUN_TEST(test_mode_decay_from_normal);
+  RUN_TEST(test_mode_decay_across_millis_wrap);
+  RUN_TEST(test_interval_and_brightness);
+  return UNITY_END();
+}
@@ -0,0 +1,114 @@
+/*
+  test_led_anim
+
+  Description:
+  ------------
+  * Frames from led_anim_frame() for the countdown bar at 0%, 50% and 100%, the partly
+    lit LED in between, and the other modes
+*/
+#include <unity.h>
+
+#include "led_anim.h"
+
+#define test_leds 10
+
+static led_rgb leds[test_leds];
+
+static bool is_dark(const led_rgb& c) {
+  return c.r == 0 && c.g == 0 && c.b == 0;
+}
+
+static uint8_t lit_count() {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < test_leds; i++)
+    if (!is_dark(leds[i])) n++;
+  return n;
+}
+
+void setUp(void) {
+  for (uint8_t i = 0; i < test_leds; i++)
+    leds[i] = {1, 2, 3};  // Anything the frame forgets to write shows up
+}
+
+void tearDown(void) {
+}
+
+void test_countdown_0_percent_is_dark(void) {
+  led_anim_frame(leds, test_leds, LED_MODE_COUNTDOWN, 0, 0);
+  TEST_ASSERT_EQUAL(0, lit_count());
+}
+
+void test_countdown_50_percent(void) {
+  // Frame 0 is the bottom of the breath, half brightness
+  led_anim_frame(leds, test_leds, LED_MODE_COUNTDOWN, 50, 0);
+  TEST_ASSERT_EQUAL(5, lit_count());
+  for (uint8_t i = 0; i < 5; i++) {
+    TEST_ASSERT_EQUAL(led_scale8(led_time_palette[7].r, 128), leds[i].r);
+    TEST_ASSERT_EQUAL(led_scale8(led_time_palette[7].g, 128), leds[i].g);
+    TEST_ASSERT_EQUAL(0, leds[i].b);
+  }
+  for (uint8_t i = 5; i < test_leds; i++)
+    TEST_ASSERT_TRUE(is_dark(leds[i]));
+}
+
+void test_countdown_100_percent(void) {
+  // Frame 64 is the top of the breath, full brightness
+  led_anim_frame(leds, test_leds, LED_MODE_COUNTDOWN, 100, 64);
+  TEST_ASSERT_EQUAL(test_leds, lit_count());
+  for (uint8_t i = 0; i < test_leds; i++) {
+    TEST_ASSERT_EQUAL(0, leds[i].r);
+    TEST_ASSERT_EQUAL(255, leds[i].g);
+    TEST_ASSERT_EQUAL(0, leds[i].b);
+  }
+}
+
+void test_countdown_over_100_is_clamped(void) {
+  led_anim_frame(leds, test_leds, LED_MODE_COUNTDOWN, 250, 64);
+  TEST_ASSERT_EQUAL(test_leds, lit_count());
+  TEST_ASSERT_EQUAL(255, leds[test_leds - 1].g);
+}
+
+void test_countdown_last_led_partly_lit(void) {
+  // 55% of 10 LEDs is 5.5, the sixth LED at half of the others
+  led_anim_frame(leds, test_leds, LED_MODE_COUNTDOWN, 55, 64);
+  TEST_ASSERT_EQUAL(6, lit_count());
+  TEST_ASSERT_EQUAL(led_scale8(leds[0].r, 128), leds[5].r);
+  TEST_ASSERT_EQUAL(led_scale8(leds[0].g, 128), leds[5].g);
+}
+
+void test_off_and_warning(void) {
+  led_anim_frame(leds, test_leds, LED_MODE_OFF, 100, 0);
+  TEST_ASSERT_EQUAL(0, lit_count());
+
+  // Dark at the start of each flash, red at the triangle peak half way through
+  led_anim_frame(leds, test_leds, LED_MODE_WARNING, 0, 0);
+  TEST_ASSERT_EQUAL(0, lit_count());
+  led_anim_frame(leds, test_leds, LED_MODE_WARNING, 0, 8);
+  TEST_ASSERT_EQUAL(test_leds, lit_count());
+  TEST_ASSERT_EQUAL(led_scale8(255, led_triwave8(128)), leds[0].r);
+  TEST_ASSERT_EQUAL(0, leds[0].g);
+}
+
+void test_connecting_chaser_tail(void) {
+  // Head on LED 3 at frame 6, tail wraps behind it
+  led_anim_frame(leds, test_leds, LED_MODE_CONNECTING, 0, 6);
+  TEST_ASSERT_EQUAL(4, lit_count());
+  TEST_ASSERT_EQUAL(led_chase_tail[0], leds[3].b);
+  TEST_ASSERT_EQUAL(led_chase_tail[3], leds[0].b);
+
+  led_anim_frame(leds, test_leds, LED_MODE_CONNECTING, 0, 0);
+  TEST_ASSERT_EQUAL(led_chase_tail[0], leds[0].b);
+  TEST_ASSERT_EQUAL(led_chase_tail[1], leds[9].b);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_countdown_0_percent_is_dark);
+  RUN_TEST(test_countdown_50_percent);
+  RUN_TEST(test_countdown_100_percent);
+  RUN_TEST(test_countdown_over_100_is_clamped);
+  RUN_TEST(test_countdown_last_led_partly_lit);
+  RUN_TEST(test_off_and_warning);
+  RUN_TEST(test_connecting_chaser_tail);
+  return UNITY_END();
+}
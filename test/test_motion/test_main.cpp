@@ -0,0 +1,196 @@
+/*
+  test_motion
+
+  Description:
+  ------------
+  * Replays accelerometer traces through the FIFO batching and motion_feed(), on a
+    virtual clock: the IMU adds a sample to its FIFO every 20 ms and loop() reads the
+    batch when motion_read_due() says so, as motion_service() does
+  * Traces: the iron resting on the bench with sensor noise, slow tilt drift and the odd
+    knock, and the iron being picked up and used
+  * Checks detection and its latency, the cooldown between reports and the number of
+    CPU wakes per minute, including with a loop() that is sometimes late
+*/
+#include <math.h>
+#include <stdio.h>
+#include <unity.h>
+
+#include "motion.h"
+
+#define test_counts_per_g    4096  // imu_counts_per_g in main.cpp
+#define test_sample_ms       20    // 50Hz
+#define test_fifo_max_frames 32    // imu_fifo_max_frames, a bigger batch is dropped
+#define test_loop_ms         7
+
+typedef accel_sample (*trace_fn)(uint32_t t_ms);
+
+struct replay_stats {
+  uint32_t reports;
+  uint32_t first_report_ms;  // 0 = none
+  uint32_t last_report_ms;
+  uint32_t min_report_gap_ms;
+  uint32_t wakes;
+  uint16_t max_batch;
+};
+
+static motion_classifier m;
+static uint32_t now_ms;
+static uint32_t next_sample_ms;
+static accel_sample fifo[test_fifo_max_frames * 2];
+static uint16_t fifo_len;
+static uint32_t rng;
+
+// xorshift32, the traces are the same on every run
+static int16_t noise(int16_t amplitude) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return (int16_t)((int32_t)(rng % (2 * amplitude + 1)) - amplitude);
+}
+
+// Lying on the bench: gravity on z, +-20 mg of noise per axis, tilting 5 degrees every
+// 10 minutes as the stand settles, and a knock on the bench every 30 seconds
+static accel_sample trace_still(uint32_t t_ms) {
+  float tilt = 0.087f * (float)t_ms / 600000.0f;
+  accel_sample s = {(int16_t)(test_counts_per_g * sinf(tilt)), 0, (int16_t)(test_counts_per_g * cosf(tilt))};
+  s.x += noise(80);
+  s.y += noise(80);
+  s.z += noise(80);
+  if (t_ms % 30000 < 2 * test_sample_ms)
+    s.z += test_counts_per_g;  // Two samples of a 1 g knock
+  return s;
+}
+
+// Picked up and moved around: a 1.5Hz wrist sway of 0.3 g and a slower 0.15 g drift
+static accel_sample trace_handling(uint32_t t_ms) {
+  float t = (float)t_ms / 1000.0f;
+  accel_sample s = {(int16_t)(0.3f * test_counts_per_g * sinf(2 * M_PI * 1.5f * t)),
+                    (int16_t)(0.15f * test_counts_per_g * sinf(2 * M_PI * 0.4f * t)),
+                    (int16_t)(test_counts_per_g * 0.95f)};
+  s.x += noise(80);
+  s.y += noise(80);
+  s.z += noise(80);
+  return s;
+}
+
+/*
+  Advance the virtual clock to until_ms, one loop() pass at a time. Every stall_every
+  passes loop() is held up by stall_ms, like a screen repaint or an MQTT reconnect
+*/
+static void replay(trace_fn trace, uint32_t until_ms, replay_stats& r, uint16_t stall_every = 0, uint32_t stall_ms = 0) {
+  uint32_t passes = 0;
+
+  while ((int32_t)(until_ms - now_ms) > 0) {
+    now_ms += (stall_every && ++passes % stall_every == 0) ? stall_ms : test_loop_ms;
+
+    // The IMU keeps sampling whatever loop() is doing
+    while ((int32_t)(now_ms - next_sample_ms) >= 0) {
+      TEST_ASSERT_LESS_THAN(sizeof(fifo) / sizeof(fifo[0]), fifo_len);
+      fifo[fifo_len++] = trace(next_sample_ms);
+      next_sample_ms += test_sample_ms;
+    }
+
+    if (!motion_read_due(m, now_ms)) continue;
+    r.wakes++;
+    if (fifo_len > r.max_batch) r.max_batch = fifo_len;
+    bool moving = motion_feed(m, fifo, fifo_len, now_ms);
+    fifo_len = 0;
+    if (!moving) continue;
+
+    if (r.reports && now_ms - r.last_report_ms < r.min_report_gap_ms) r.min_report_gap_ms = now_ms - r.last_report_ms;
+    if (!r.reports) r.first_report_ms = now_ms;
+    r.last_report_ms = now_ms;
+    r.reports++;
+  }
+}
+
+static replay_stats new_stats() {
+  replay_stats r = {};
+  r.min_report_gap_ms = UINT32_MAX;
+  return r;
+}
+
+void setUp(void) {
+  motion_init(m, test_counts_per_g);
+  now_ms = 100000;
+  m.last_read_ms = now_ms;
+  next_sample_ms = now_ms + test_sample_ms;
+  fifo_len = 0;
+  rng = 2463534242UL;
+}
+
+void tearDown(void) {
+}
+
+void test_still_trace_never_triggers(void) {
+  replay_stats r = new_stats();
+  replay(trace_still, now_ms + 10 * 60000, r);
+
+  TEST_ASSERT_EQUAL(0, r.reports);
+  TEST_ASSERT_EQUAL(10 * 120, r.wakes);  // Twice a second
+  TEST_ASSERT_EQUAL(motion_read_ms / test_sample_ms, r.max_batch);
+}
+
+void test_handling_detected(void) {
+  replay_stats r = new_stats();
+  replay(trace_still, now_ms + 30000, r);
+  TEST_ASSERT_EQUAL(0, r.reports);
+
+  uint32_t picked_up_ms = now_ms;
+  r = new_stats();
+  replay(trace_handling, now_ms + 3000, r);
+
+  // 200 ms of movement, then up to one read interval until the batch is looked at
+  TEST_ASSERT_EQUAL(1, r.reports);
+  TEST_ASSERT_LESS_OR_EQUAL(200 + motion_read_ms + test_loop_ms, r.first_report_ms - picked_up_ms);
+
+  char msg[48];
+  snprintf(msg, sizeof(msg), "Detected %u ms after pick up", (unsigned)(r.first_report_ms - picked_up_ms));
+  TEST_MESSAGE(msg);
+}
+
+void test_cooldown_while_handling(void) {
+  replay_stats r = new_stats();
+  replay(trace_handling, now_ms + 60000, r);
+
+  // One report per cooldown, the first straight away
+  TEST_ASSERT_EQUAL(60000 / motion_cooldown_ms, r.reports);
+  TEST_ASSERT_GREATER_OR_EQUAL(motion_cooldown_ms, r.min_report_gap_ms);
+  TEST_ASSERT_LESS_OR_EQUAL(motion_cooldown_ms + motion_read_ms, r.min_report_gap_ms);
+
+  // Put down again, the reports stop
+  r = new_stats();
+  replay(trace_still, now_ms + 60000, r);
+  TEST_ASSERT_EQUAL(0, r.reports);
+}
+
+void test_wakes_per_minute_with_late_loop(void) {
+  // Every 50th pass loop() is 150 ms late, reads stay on the grid
+  replay_stats r = new_stats();
+  replay(trace_still, now_ms + 5 * 60000, r, 50, 150);
+
+  TEST_ASSERT_EQUAL(5 * 120, r.wakes);
+  TEST_ASSERT_LESS_OR_EQUAL(test_fifo_max_frames, r.max_batch);
+  TEST_ASSERT_EQUAL(0, r.reports);
+}
+
+void test_read_due_resyncs_after_long_stall(void) {
+  uint32_t start = now_ms;
+  TEST_ASSERT_FALSE(motion_read_due(m, start + motion_read_ms - 1));
+  TEST_ASSERT_TRUE(motion_read_due(m, start + motion_read_ms));
+
+  // Seconds behind (e.g. OTA): one read, then back to the interval rather than a burst
+  TEST_ASSERT_TRUE(motion_read_due(m, start + 5000));
+  TEST_ASSERT_FALSE(motion_read_due(m, start + 5000 + motion_read_ms - 1));
+  TEST_ASSERT_TRUE(motion_read_due(m, start + 5000 + motion_read_ms));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_still_trace_never_triggers);
+  RUN_TEST(test_handling_detected);
+  RUN_TEST(test_cooldown_while_handling);
+  RUN_TEST(test_wakes_per_minute_with_late_loop);
+  RUN_TEST(test_read_due_resyncs_after_long_stall);
+  return UNITY_END();
+}
@@ -0,0 +1,174 @@
+/*
+  test_net_power
+
+  Description:
+  ------------
+  * net_window_due(): one window per period, no burst after a late call
+  * net_window_align(): windows open net_wake_rx_us after a beacon on the listen interval
+    grid of the AP's TSF, whatever micros() reads, and a realign pulls drifted windows back
+  * net_pub_push(): topics are copied, kept publishes are never dropped or merged, and a
+    full queue makes room by dropping the oldest one that isn't kept
+*/
+#include <unity.h>
+
+#include "net_power.h"
+
+#define test_listen_interval 3
+#define test_period_us       (test_listen_interval * net_beacon_us)
+
+static net_window w;
+static net_pub_queue q;
+
+void setUp(void) {
+  net_window_init(w, test_listen_interval, 0);
+  q = {};
+}
+
+void tearDown(void) {
+}
+
+void test_one_window_per_period(void) {
+  uint32_t windows = 0;
+  for (uint32_t now_us = 0; now_us < 10 * test_period_us; now_us += 1000)
+    if (net_window_due(w, now_us)) windows++;
+  TEST_ASSERT_EQUAL(10, windows);
+
+  // Every call is a window with power save off
+  net_window_init(w, 0, 0);
+  TEST_ASSERT_TRUE(net_window_due(w, 5));
+  TEST_ASSERT_TRUE(net_window_due(w, 5));
+}
+
+void test_late_call_no_burst(void) {
+  TEST_ASSERT_TRUE(net_window_due(w, 0));
+  TEST_ASSERT_TRUE(net_window_due(w, 5 * test_period_us));
+  TEST_ASSERT_FALSE(net_window_due(w, 5 * test_period_us + 1000));
+  TEST_ASSERT_TRUE(net_window_due(w, 6 * test_period_us));
+}
+
+void test_align_opens_after_wake(void) {
+  // micros() and the TSF have nothing in common, 1 ms after a wake on the TSF grid
+  int64_t tsf_us = 1000000LL * test_period_us + 1000;
+  uint32_t now_us = 0xfffff000;  // Close to wrapping
+  TEST_ASSERT_TRUE(net_window_align(w, tsf_us, now_us));
+  TEST_ASSERT_EQUAL_UINT32(now_us - 1000 + net_wake_rx_us, w.next_us);
+
+  // Just after the rx margin the next window is a whole listen interval away
+  tsf_us += net_wake_rx_us;
+  TEST_ASSERT_TRUE(net_window_align(w, tsf_us, now_us));
+  TEST_ASSERT_EQUAL_UINT32(now_us - 1000 + test_period_us, w.next_us);
+}
+
+void test_align_needs_tsf_and_period(void) {
+  TEST_ASSERT_FALSE(net_window_align(w, 0, 1000));
+  TEST_ASSERT_EQUAL_UINT32(0, w.next_us);
+
+  net_window_init(w, 0, 0);
+  TEST_ASSERT_FALSE(net_window_align(w, 123456, 1000));
+}
+
+/*
+  The local clock runs 100 ppm fast against the AP. Without realigning the windows walk
+  off the wakes, realigning every 10 seconds keeps them within the rx margin
+*/
+void test_realign_follows_drift(void) {
+  int64_t tsf_start_us = 5000000LL * net_beacon_us;
+  uint32_t worst_us = 0;
+
+  TEST_ASSERT_TRUE(net_window_align(w, tsf_start_us, 0));
+  uint32_t last_align_us = 0;
+  for (uint32_t now_us = 0; now_us < 120000000; now_us += 100) {
+    int64_t tsf_us = tsf_start_us + (int64_t)now_us * 10000 / 10001;
+    if (now_us - last_align_us >= 10000000) {
+      net_window_align(w, tsf_us, now_us);
+      last_align_us = now_us;
+    }
+    if (!net_window_due(w, now_us)) continue;
+
+    uint32_t after_wake_us = (uint32_t)((uint64_t)tsf_us % test_period_us);
+    uint32_t off_us = (after_wake_us > net_wake_rx_us) ? after_wake_us - net_wake_rx_us : net_wake_rx_us - after_wake_us;
+    if (off_us > worst_us) worst_us = off_us;
+  }
+  TEST_ASSERT_LESS_THAN(net_wake_rx_us / 2, worst_us);
+}
+
+// A profile change: the old appliance is switched off and the new one on, on their own topics
+void test_pub_topic_is_copied(void) {
+  char topic[net_topic_len] = "iron/state";
+  TEST_ASSERT_TRUE(net_pub_push(q, topic, "Off", true));
+  strcpy(topic, "heater/state");
+  TEST_ASSERT_TRUE(net_pub_push(q, topic, "On", false));
+
+  TEST_ASSERT_EQUAL(2, q.count);
+  TEST_ASSERT_EQUAL_STRING("iron/state", q.msgs[0].topic);
+  TEST_ASSERT_EQUAL_STRING("Off", q.msgs[0].payload);
+  net_pub_pop(q);
+  TEST_ASSERT_EQUAL_STRING("heater/state", q.msgs[0].topic);
+  TEST_ASSERT_EQUAL_STRING("On", q.msgs[0].payload);
+  net_pub_pop(q);
+  TEST_ASSERT_EQUAL(0, q.count);
+  net_pub_pop(q);
+  TEST_ASSERT_EQUAL(0, q.count);
+}
+
+void test_pub_repeats(void) {
+  TEST_ASSERT_TRUE(net_pub_push(q, "iron/state", "On", false));
+  TEST_ASSERT_TRUE(net_pub_push(q, "iron/state", "On", false));
+  TEST_ASSERT_EQUAL(1, q.count);
+
+  // Same payload on another topic is a different publish
+  TEST_ASSERT_TRUE(net_pub_push(q, "heater/state", "On", false));
+  TEST_ASSERT_EQUAL(2, q.count);
+
+  // Kept ones are never merged
+  TEST_ASSERT_TRUE(net_pub_push(q, "heater/state", "Off", true));
+  TEST_ASSERT_TRUE(net_pub_push(q, "heater/state", "Off", true));
+  TEST_ASSERT_EQUAL(4, q.count);
+}
+
+void test_pub_full_drops_oldest_not_kept(void) {
+  net_pub_push(q, "a", "Off", true);
+  net_pub_push(q, "b", "On", false);
+  net_pub_push(q, "b", "Off", true);
+  net_pub_push(q, "c", "On", false);
+  TEST_ASSERT_TRUE(net_pub_push(q, "d", "On", false));
+
+  const char* topics[] = {"a", "b", "c", "d"};
+  const char* payloads[] = {"Off", "Off", "On", "On"};
+  TEST_ASSERT_EQUAL(net_pub_queue_len, q.count);
+  for (uint8_t i = 0; i < net_pub_queue_len; i++) {
+    TEST_ASSERT_EQUAL_STRING(topics[i], q.msgs[i].topic);
+    TEST_ASSERT_EQUAL_STRING(payloads[i], q.msgs[i].payload);
+  }
+}
+
+void test_pub_full_of_kept(void) {
+  const char* topics[] = {"a", "b", "c", "d"};
+  for (uint8_t i = 0; i < net_pub_queue_len; i++)
+    TEST_ASSERT_TRUE(net_pub_push(q, topics[i], "Off", true));
+  TEST_ASSERT_FALSE(net_pub_push(q, "e", "Off", true));
+  TEST_ASSERT_FALSE(net_pub_push(q, "e", "On", false));
+  TEST_ASSERT_EQUAL_STRING("a", q.msgs[0].topic);
+  TEST_ASSERT_EQUAL_STRING("d", q.msgs[net_pub_queue_len - 1].topic);
+}
+
+void test_pub_long_topic_is_cut(void) {
+  const char* long_topic = "0123456789012345678901234567890123456789";
+  TEST_ASSERT_TRUE(net_pub_push(q, long_topic, "On", false));
+  TEST_ASSERT_EQUAL(net_topic_len - 1, strlen(q.msgs[0].topic));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_one_window_per_period);
+  RUN_TEST(test_late_call_no_burst);
+  RUN_TEST(test_align_opens_after_wake);
+  RUN_TEST(test_align_needs_tsf_and_period);
+  RUN_TEST(test_realign_follows_drift);
+  RUN_TEST(test_pub_topic_is_copied);
+  RUN_TEST(test_pub_repeats);
+  RUN_TEST(test_pub_full_drops_oldest_not_kept);
+  RUN_TEST(test_pub_full_of_kept);
+  RUN_TEST(test_pub_long_topic_is_cut);
+  return UNITY_END();
+}
@@ -0,0 +1,93 @@
+/*
+  test_rtc_snapshot
+
+  Description:
+  ------------
+  * Every rtc_snapshot_check() result, and the DHCP lease age limit
+  * A build without MQTT over TLS doesn't reserve RTC memory for a TLS session
+*/
+#include <unity.h>
+
+#include "rtc_snapshot.h"
+
+static rtc_snapshot snap;
+
+void setUp(void) {
+  memset(&snap, 0, sizeof(snap));
+  snap.timer_start_sec = 300;
+  snap.wifi_channel = 6;
+  snap.local_ip = 0x2500A8C0;  // 192.168.0.37
+  snap.lease_start_sec = 1000;
+  snap.bar_percent = 100;
+  snap.boot_count = 7;
+  rtc_snapshot_seal(&snap);
+}
+
+void tearDown(void) {
+}
+
+void test_ok(void) {
+  TEST_ASSERT_EQUAL(RTC_SNAPSHOT_OK, rtc_snapshot_check(&snap));
+}
+
+void test_empty(void) {
+  rtc_snapshot_invalidate(&snap);
+  TEST_ASSERT_EQUAL(RTC_SNAPSHOT_EMPTY, rtc_snapshot_check(&snap));
+}
+
+void test_version(void) {
+  snap.version = rtc_snapshot_version - 1;
+  snap.crc = rtc_snapshot_calc_crc(&snap);  // Valid in every other way
+  TEST_ASSERT_EQUAL(RTC_SNAPSHOT_VERSION, rtc_snapshot_check(&snap));
+}
+
+void test_corrupt_flipped_byte(void) {
+  // Every byte covered by the CRC, one at a time
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(&snap);
+  for (size_t i = offsetof(rtc_snapshot, timer_start_sec); i < offsetof(rtc_snapshot, crc); i++) {
+    bytes[i] ^= 0x10;
+    TEST_ASSERT_EQUAL(RTC_SNAPSHOT_CORRUPT, rtc_snapshot_check(&snap));
+    bytes[i] ^= 0x10;
+  }
+  TEST_ASSERT_EQUAL(RTC_SNAPSHOT_OK, rtc_snapshot_check(&snap));
+}
+
+void test_corrupt_wrong_size(void) {
+  // Written by a build with a different layout but the same version number
+  snap.size = sizeof(rtc_snapshot) - 4;
+  snap.crc = rtc_snapshot_calc_crc(&snap);
+  TEST_ASSERT_EQUAL(RTC_SNAPSHOT_CORRUPT, rtc_snapshot_check(&snap));
+}
+
+void test_lease_age(void) {
+  TEST_ASSERT_TRUE(rtc_snapshot_lease_valid(&snap, 1000));
+  TEST_ASSERT_TRUE(rtc_snapshot_lease_valid(&snap, 1000 + rtc_lease_max_sec - 1));
+  TEST_ASSERT_FALSE(rtc_snapshot_lease_valid(&snap, 1000 + rtc_lease_max_sec));
+
+  // RTC clock reset by a power loss
+  TEST_ASSERT_FALSE(rtc_snapshot_lease_valid(&snap, 10));
+
+  // Nothing cached
+  snap.local_ip = 0;
+  TEST_ASSERT_FALSE(rtc_snapshot_lease_valid(&snap, 1000));
+}
+
+void test_tls_session_only_with_tls(void) {
+#if MQTT_TLS_MODE
+  TEST_ASSERT_GREATER_THAN(rtc_tls_session_max, sizeof(rtc_snapshot));
+#else
+  TEST_ASSERT_LESS_THAN(128, sizeof(rtc_snapshot));
+#endif
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ok);
+  RUN_TEST(test_empty);
+  RUN_TEST(test_version);
+  RUN_TEST(test_corrupt_flipped_byte);
+  RUN_TEST(test_corrupt_wrong_size);
+  RUN_TEST(test_lease_age);
+  RUN_TEST(test_tls_session_only_with_tls);
+  return UNITY_END();
+}
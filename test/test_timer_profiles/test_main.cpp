@@ -0,0 +1,120 @@
+/*
+  test_timer_profiles
+
+  Description:
+  ------------
+  * Bar graph scale: tick count, tick positions and labels for the default profiles
+    and the durations that used to get truncated labels
+  * Profile record validation
+*/
+#include <unity.h>
+
+#include "timer_profiles.h"
+#include "ui_layout.h"
+
+static char label[10];
+
+static const char* scale_label(uint16_t duration_sec, uint8_t tick) {
+  profile_scale_label(label, sizeof(label), duration_sec, tick, profile_scale_ticks(duration_sec));
+  return label;
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_scale_ticks(void) {
+  TEST_ASSERT_EQUAL(5, profile_scale_ticks(300));   // Iron
+  TEST_ASSERT_EQUAL(5, profile_scale_ticks(900));   // Glue gun
+  TEST_ASSERT_EQUAL(3, profile_scale_ticks(180));   // Heat gun
+  TEST_ASSERT_EQUAL(6, profile_scale_ticks(1800));  // Oven
+  TEST_ASSERT_EQUAL(4, profile_scale_ticks(240));
+  TEST_ASSERT_EQUAL(2, profile_scale_ticks(120));
+  TEST_ASSERT_EQUAL(5, profile_scale_ticks(150));  // Not whole minutes
+}
+
+void test_oven_labels(void) {
+  static const char* const expected[] = {"0", "5", "10", "15", "20", "25", "30"};
+  for (uint8_t i = 0; i <= 6; i++)
+    TEST_ASSERT_EQUAL_STRING(expected[i], scale_label(1800, i));
+}
+
+void test_short_durations_label_every_minute(void) {
+  static const char* const expected_240[] = {"0", "1", "2", "3", "4"};
+  for (uint8_t i = 0; i <= 4; i++)
+    TEST_ASSERT_EQUAL_STRING(expected_240[i], scale_label(240, i));
+
+  static const char* const expected_120[] = {"0", "1", "2"};
+  for (uint8_t i = 0; i <= 2; i++)
+    TEST_ASSERT_EQUAL_STRING(expected_120[i], scale_label(120, i));
+}
+
+void test_part_minutes_labelled_with_seconds(void) {
+  TEST_ASSERT_EQUAL_STRING("0", scale_label(150, 0));
+  TEST_ASSERT_EQUAL_STRING("0:30", scale_label(150, 1));
+  TEST_ASSERT_EQUAL_STRING("2", scale_label(150, 4));
+  TEST_ASSERT_EQUAL_STRING("2:30", scale_label(150, 5));
+}
+
+void test_tick_positions_span_the_bar(void) {
+  for (uint8_t major = 2; major <= 6; major++) {
+    uint8_t minor = major * 2;
+    TEST_ASSERT_EQUAL(layout::bar.x, layout::scale_tick_x(0, minor));
+    TEST_ASSERT_EQUAL(layout::bar.right(), layout::scale_tick_x(minor, minor));
+
+    // Evenly spread, gaps differ by at most a pixel
+    int16_t min_gap = layout::bar.w;
+    int16_t max_gap = 0;
+    for (uint8_t i = 1; i <= minor; i++) {
+      int16_t gap = layout::scale_tick_x(i, minor) - layout::scale_tick_x(i - 1, minor);
+      if (gap < min_gap) min_gap = gap;
+      if (gap > max_gap) max_gap = gap;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(1, max_gap - min_gap);
+  }
+}
+
+void test_default_profiles_valid(void) {
+  for (uint8_t n = 0; n < max_profiles; n++) {
+    timer_profile p = default_profiles[n];
+    profile_seal(&p);
+    TEST_ASSERT_TRUE(profile_valid(&p));
+  }
+}
+
+void test_profile_rejected(void) {
+  timer_profile p = default_profiles[0];
+  profile_seal(&p);
+
+  p.duration_sec = profile_min_duration - 1;
+  TEST_ASSERT_FALSE(profile_valid(&p));  // CRC no longer matches
+  p.crc = profile_calc_crc(&p);
+  TEST_ASSERT_FALSE(profile_valid(&p));  // Too short
+
+  p.duration_sec = profile_max_duration;
+  profile_seal(&p);
+  TEST_ASSERT_TRUE(profile_valid(&p));  // 99:59
+  p.duration_sec = profile_max_duration + 1;
+  profile_seal(&p);
+  TEST_ASSERT_FALSE(profile_valid(&p));  // Too long for the mm:ss timer text
+
+  p = default_profiles[0];
+  p.warning_sec = 255;
+  p.duration_sec = 200;
+  profile_seal(&p);
+  TEST_ASSERT_FALSE(profile_valid(&p));  // Warning longer than the timer
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_scale_ticks);
+  RUN_TEST(test_oven_labels);
+  RUN_TEST(test_short_durations_label_every_minute);
+  RUN_TEST(test_part_minutes_labelled_with_seconds);
+  RUN_TEST(test_tick_positions_span_the_bar);
+  RUN_TEST(test_default_profiles_valid);
+  RUN_TEST(test_profile_rejected);
+  return UNITY_END();
+}
@@ -0,0 +1,126 @@
+/*
+  test_udp_proto
+
+  Description:
+  ------------
+  * udp_encode() / udp_decode() round trip and rejection of foreign datagrams
+  * Confirmable message retransmit back off, ACK matching and giving up
+  * Shared token check for EXTEND
+*/
+#include <unity.h>
+
+#include "udp_proto.h"
+
+static udp_msg make_msg(udp_type type, udp_code code, uint16_t msg_id, const char* payload) {
+  udp_msg msg = {};
+  msg.type = type;
+  msg.code = code;
+  msg.msg_id = msg_id;
+  msg.timer_sec = 0;
+  msg.payload_len = (uint8_t)strlen(payload);
+  memcpy(msg.payload, payload, msg.payload_len);
+  return msg;
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_encode_decode_round_trip(void) {
+  udp_msg tx = make_msg(UDP_CON, UDP_CODE_STATUS, 0xBEEF, "Iron");
+  tx.timer_sec = 299;
+  uint8_t buf[udp_header_len + udp_max_payload];
+
+  uint16_t len = udp_encode(tx, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(udp_header_len + 4, len);
+  TEST_ASSERT_EQUAL(0x40, buf[0]);  // Version 1, CON
+  TEST_ASSERT_EQUAL(0xBE, buf[2]);  // Big endian ID
+  TEST_ASSERT_EQUAL(0xEF, buf[3]);
+
+  udp_msg rx;
+  TEST_ASSERT_TRUE(udp_decode(buf, len, rx));
+  TEST_ASSERT_EQUAL(UDP_CON, rx.type);
+  TEST_ASSERT_EQUAL(UDP_CODE_STATUS, rx.code);
+  TEST_ASSERT_EQUAL(0xBEEF, rx.msg_id);
+  TEST_ASSERT_EQUAL(299, rx.timer_sec);
+  TEST_ASSERT_EQUAL(4, rx.payload_len);
+  TEST_ASSERT_EQUAL(0, memcmp(rx.payload, "Iron", 4));
+}
+
+void test_encode_buffer_too_small(void) {
+  udp_msg tx = make_msg(UDP_NON, UDP_CODE_STATUS, 1, "Glue gun");
+  uint8_t buf[udp_header_len + 4];
+  TEST_ASSERT_EQUAL(0, udp_encode(tx, buf, sizeof(buf)));
+}
+
+void test_decode_rejects_short_and_foreign(void) {
+  uint8_t buf[udp_header_len] = {0x40, UDP_CODE_PING, 0, 1, 0, 0};
+  udp_msg rx;
+  TEST_ASSERT_FALSE(udp_decode(buf, udp_header_len - 1, rx));
+
+  buf[0] = 0x80;  // Version 2
+  TEST_ASSERT_FALSE(udp_decode(buf, sizeof(buf), rx));
+}
+
+void test_retransmit_backs_off_then_gives_up(void) {
+  udp_pending p = {};
+  udp_pending_start(p, make_msg(UDP_CON, UDP_CODE_STATUS, 7, ""), 1000);
+
+  // First send straight away, then after 250, 500, 1000, 2000 ms
+  TEST_ASSERT_TRUE(udp_pending_due(p, 1000));
+  TEST_ASSERT_FALSE(udp_pending_due(p, 1249));
+  uint32_t t = 1000;
+  uint32_t gap = udp_ack_timeout_ms;
+  for (uint8_t i = 0; i < udp_max_retransmit; i++) {
+    t += gap;
+    TEST_ASSERT_FALSE(udp_pending_due(p, t - 1));
+    TEST_ASSERT_TRUE(udp_pending_due(p, t));
+    gap *= 2;
+  }
+
+  // Nobody answered, the next check gives up
+  TEST_ASSERT_FALSE(udp_pending_due(p, t + gap));
+  TEST_ASSERT_FALSE(p.active);
+}
+
+void test_ack_matches_message_id(void) {
+  udp_pending p = {};
+  udp_pending_start(p, make_msg(UDP_CON, UDP_CODE_STATUS, 42, ""), 0);
+  udp_pending_due(p, 0);
+
+  TEST_ASSERT_FALSE(udp_pending_ack(p, make_msg(UDP_ACK, UDP_CODE_EMPTY, 41, "")));
+  TEST_ASSERT_FALSE(udp_pending_ack(p, make_msg(UDP_RST, UDP_CODE_EMPTY, 42, "")));
+  TEST_ASSERT_TRUE(p.active);
+
+  TEST_ASSERT_TRUE(udp_pending_ack(p, make_msg(UDP_ACK, UDP_CODE_EMPTY, 42, "")));
+  TEST_ASSERT_FALSE(p.active);
+  TEST_ASSERT_FALSE(udp_pending_due(p, 10000));
+}
+
+void test_token(void) {
+  TEST_ASSERT_TRUE(udp_token_ok(make_msg(UDP_CON, UDP_CODE_EXTEND, 1, "secret"), "secret"));
+
+  TEST_ASSERT_FALSE(udp_token_ok(make_msg(UDP_CON, UDP_CODE_EXTEND, 1, "secreT"), "secret"));
+  TEST_ASSERT_FALSE(udp_token_ok(make_msg(UDP_CON, UDP_CODE_EXTEND, 1, "secret!"), "secret"));  // Prefix matches
+  TEST_ASSERT_FALSE(udp_token_ok(make_msg(UDP_CON, UDP_CODE_EXTEND, 1, "secre"), "secret"));
+  TEST_ASSERT_FALSE(udp_token_ok(make_msg(UDP_CON, UDP_CODE_EXTEND, 1, ""), "secret"));
+}
+
+void test_no_token_configured_refuses(void) {
+  TEST_ASSERT_FALSE(udp_token_ok(make_msg(UDP_CON, UDP_CODE_EXTEND, 1, ""), ""));
+  TEST_ASSERT_FALSE(udp_token_ok(make_msg(UDP_CON, UDP_CODE_EXTEND, 1, "anything"), ""));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_encode_decode_round_trip);
+  RUN_TEST(test_encode_buffer_too_small);
+  RUN_TEST(test_decode_rejects_short_and_foreign);
+  RUN_TEST(test_retransmit_backs_off_then_gives_up);
+  RUN_TEST(test_ack_matches_message_id);
+  RUN_TEST(test_token);
+  RUN_TEST(test_no_token_configured_refuses);
+  return UNITY_END();
+}
@@ -0,0 +1,143 @@
+/*
+  test_ui_widgets
+
+  Description:
+  ------------
+  * ui_show() erase and cover rules and ui_render() painting, with stub paint, erase
+    and clock callbacks standing in for the LCD
+*/
+#include <unity.h>
+
+#include "ui_widgets.h"
+
+enum test_widget : uint8_t {
+  T_COMMON = 0,  // On every screen, like the title bar
+  T_SMALL,       // Inside T_BIG
+  T_BIG,
+  T_BESIDE,      // Overlaps T_BIG but doesn't contain it
+  T_COUNT,
+};
+
+static uint32_t fake_us;
+static uint8_t paints[T_COUNT];
+static uint8_t erases;
+static ui_rect last_erase;
+
+static uint32_t fake_clock() {
+  return fake_us += 10;
+}
+
+static void fake_erase(const ui_rect& r) {
+  erases++;
+  last_erase = r;
+}
+
+static ui_widget widgets[T_COUNT];
+
+// Find which widget was painted from its rectangle
+static void fake_paint(const ui_rect& r) {
+  for (uint8_t i = 0; i < T_COUNT; i++)
+    if (widgets[i].rect.x == r.x && widgets[i].rect.y == r.y && widgets[i].rect.w == r.w && widgets[i].rect.h == r.h)
+      paints[i]++;
+}
+
+static ui_tree ui;
+
+void setUp(void) {
+  widgets[T_COMMON] = {"common", {0, 0, 320, 45}, fake_paint, false, 0};
+  widgets[T_SMALL] = {"small", {20, 60, 100, 40}, fake_paint, false, 0};
+  widgets[T_BIG] = {"big", {10, 50, 200, 100}, fake_paint, false, 0};
+  widgets[T_BESIDE] = {"beside", {150, 50, 160, 100}, fake_paint, false, 0};
+  ui = {widgets, T_COUNT, 0, fake_erase, fake_clock, 0};
+  fake_us = 0;
+  erases = 0;
+  for (uint8_t i = 0; i < T_COUNT; i++)
+    paints[i] = 0;
+}
+
+void tearDown(void) {
+}
+
+void test_first_screen_paints_without_erasing(void) {
+  ui_show(ui, ui_bit(T_COMMON) | ui_bit(T_SMALL));
+  ui_render_stats stats = ui_render(ui);
+
+  TEST_ASSERT_EQUAL(2, stats.painted);
+  TEST_ASSERT_EQUAL(0, stats.erased);
+  TEST_ASSERT_EQUAL(0, erases);
+  TEST_ASSERT_EQUAL(1, paints[T_COMMON]);
+  TEST_ASSERT_EQUAL(1, paints[T_SMALL]);
+}
+
+void test_common_widget_left_alone(void) {
+  ui_show(ui, ui_bit(T_COMMON) | ui_bit(T_SMALL));
+  ui_render(ui);
+  ui_show(ui, ui_bit(T_COMMON) | ui_bit(T_BIG));
+  ui_render(ui);
+
+  TEST_ASSERT_EQUAL(1, paints[T_COMMON]);
+  TEST_ASSERT_EQUAL(1, paints[T_BIG]);
+}
+
+void test_covered_widget_not_erased(void) {
+  ui_show(ui, ui_bit(T_SMALL));
+  ui_render(ui);
+  ui_show(ui, ui_bit(T_BIG));  // T_BIG paints over all of T_SMALL
+  ui_render_stats stats = ui_render(ui);
+
+  TEST_ASSERT_EQUAL(0, erases);
+  TEST_ASSERT_EQUAL(0, stats.erased);
+  TEST_ASSERT_EQUAL(1, stats.painted);
+}
+
+void test_uncovered_widget_erased(void) {
+  ui_show(ui, ui_bit(T_BIG));
+  ui_render(ui);
+  ui_show(ui, ui_bit(T_BESIDE));  // Overlapping is not enough
+
+  TEST_ASSERT_EQUAL(1, erases);
+  TEST_ASSERT_EQUAL(widgets[T_BIG].rect.x, last_erase.x);
+  TEST_ASSERT_EQUAL(widgets[T_BIG].rect.w, last_erase.w);
+
+  // The erase is counted in the next render, then cleared
+  TEST_ASSERT_EQUAL(1, ui_render(ui).erased);
+  TEST_ASSERT_EQUAL(0, ui_render(ui).erased);
+}
+
+void test_only_visible_dirty_widgets_painted(void) {
+  ui_show(ui, ui_bit(T_COMMON));
+  ui_render(ui);
+
+  ui_invalidate(ui, T_COMMON);
+  ui_invalidate(ui, T_BESIDE);  // Hidden, stays dirty until it is shown
+  ui_invalidate(ui, T_COUNT);   // Out of range, ignored
+  ui_render_stats stats = ui_render(ui);
+  TEST_ASSERT_EQUAL(1, stats.painted);
+  TEST_ASSERT_EQUAL(2, paints[T_COMMON]);
+  TEST_ASSERT_EQUAL(0, paints[T_BESIDE]);
+  TEST_ASSERT_TRUE(widgets[T_BESIDE].dirty);
+
+  // Nothing dirty, nothing painted
+  TEST_ASSERT_EQUAL(0, ui_render(ui).painted);
+}
+
+void test_paint_time_recorded(void) {
+  ui_show(ui, ui_bit(T_COMMON) | ui_bit(T_BIG));
+  ui_render_stats stats = ui_render(ui);
+
+  // The fake clock moves 10 us per read, each paint is timed by two reads
+  TEST_ASSERT_EQUAL(10, widgets[T_COMMON].paint_us);
+  TEST_ASSERT_EQUAL(10, widgets[T_BIG].paint_us);
+  TEST_ASSERT_EQUAL(50, stats.us);
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_screen_paints_without_erasing);
+  RUN_TEST(test_common_widget_left_alone);
+  RUN_TEST(test_covered_widget_not_erased);
+  RUN_TEST(test_uncovered_widget_erased);
+  RUN_TEST(test_only_visible_dirty_widgets_painted);
+  RUN_TEST(test_paint_time_recorded);
+  return UNITY_END();
+}
@@ -0,0 +1,61 @@
+#!/bin/sh
+# tls_broker.sh
+#
+# Local MQTT over TLS broker, for trying MQTT_TLS_MODE=1 and for the "tlsbench" command
+#   * Makes a throwaway CA and a certificate for this machine's IP address in tools/tls_broker/
+#   * Writes include/mqtt_tls_credentials.h with the CA certificate
+#   * Runs mosquitto with a TLS 1.2 listener on 8883
+#
+# Usage:
+#   tools/tls_broker.sh <this machine's IP address> [rsa|ec]
+# Then put the address in mqtt_brokers[] in main.cpp, build with -DMQTT_TLS_MODE=1 and send
+# "tlsbench 10" on the command topic. Results are published on iron_timer/tlsbench
+set -e
+
+ip="$1"
+key_type="${2:-rsa}"
+if [ -z "$ip" ]; then
+  echo "Usage: $0 <this machine's IP address> [rsa|ec]" >&2
+  exit 1
+fi
+
+root="$(cd "$(dirname "$0")/.." && pwd)"
+dir="$root/tools/tls_broker"
+mkdir -p "$dir"
+cd "$dir"
+
+if [ "$key_type" = "ec" ]; then
+  key_opt="-newkey ec -pkeyopt ec_paramgen_curve:prime256v1"
+else
+  key_opt="-newkey rsa:2048"
+fi
+
+# Certificates are made once, delete tools/tls_broker/ to start again
+if [ ! -f server.crt ]; then
+  openssl req -x509 $key_opt -nodes -days 3650 -subj "/CN=iron timer test CA" -keyout ca.key -out ca.crt
+  openssl req $key_opt -nodes -subj "/CN=$ip" -keyout server.key -out server.csr
+  # mbedTLS matches the host name against DNS names only, so the address goes in as both
+  printf "subjectAltName=DNS:%s,IP:%s\n" "$ip" "$ip" > server.ext
+  openssl x509 -req -in server.csr -CA ca.crt -CAkey ca.key -CAcreateserial -days 3650 -extfile server.ext -out server.crt
+fi
+
+{
+  echo "// Written by tools/tls_broker.sh for the test broker at $ip"
+  echo "#pragma once"
+  echo
+  echo "#define MQTT_CA_CERT \\"
+  sed 's/.*/  "&\\n" \\/' ca.crt
+  echo
+} > "$root/include/mqtt_tls_credentials.h"
+
+cat > mosquitto.conf <<EOF
+allow_anonymous true
+listener 8883
+cafile $dir/ca.crt
+certfile $dir/server.crt
+keyfile $dir/server.key
+tls_version tlsv1.2
+EOF
+
+echo "Wrote include/mqtt_tls_credentials.h, starting mosquitto on $ip:8883"
+exec mosquitto -v -c mosquitto.conf
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""
+udp_peer.py
+
+Description:
+------------
+* Test peer for the UDP control channel (include/udp_proto.h), run on a PC on the same LAN
+* Measures command round trip time over UDP (CON PING -> ACK) and over MQTT
+  ("ping <n>" on the command topic -> reply on iron_timer/pong) and prints both
+* Python 3 standard library only, the MQTT side is a minimal MQTT 3.1.1 client
+
+Usage:
+------
+  python3 tools/udp_peer.py <device ip> --broker <broker ip> [--count 50]
+  python3 tools/udp_peer.py <device ip> --extend --token secret   # One EXTEND, prints the new timer
+"""
+import argparse
+import random
+import socket
+import statistics
+import struct
+import time
+
+UDP_PORT = 5683
+UDP_VERSION = 1
+UDP_CON, UDP_NON, UDP_ACK, UDP_RST = 0, 1, 2, 3
+UDP_CODE_EXTEND, UDP_CODE_PING = 2, 4
+PONG_TOPIC = "iron_timer/pong"
+
+
+def udp_encode(msg_type, code, msg_id, payload=b""):
+    return struct.pack(">BBHH", (UDP_VERSION << 6) | msg_type, code, msg_id, 0) + payload
+
+
+def udp_decode(data):
+    if len(data) < 6 or data[0] >> 6 != UDP_VERSION:
+        return None
+    _, code, msg_id, timer_sec = struct.unpack(">BBHH", data[:6])
+    return data[0] & 0x03, code, msg_id, timer_sec
+
+
+def udp_request(sock, addr, code, msg_id, payload, timeout):
+    """Send one CON message and wait for its ACK, returns (rtt ms, reply) or (None, None)"""
+    start = time.monotonic()
+    sock.sendto(udp_encode(UDP_CON, code, msg_id, payload), addr)
+    while True:
+        left = timeout - (time.monotonic() - start)
+        if left <= 0:
+            return None, None
+        sock.settimeout(left)
+        try:
+            data, _ = sock.recvfrom(64)
+        except socket.timeout:
+            return None, None
+        reply = udp_decode(data)
+        if reply and reply[0] == UDP_CON:
+            # Confirmable status from the device, ACK it so it stops retransmitting
+            sock.sendto(udp_encode(UDP_ACK, 0, reply[2]), addr)
+            continue
+        if reply and reply[0] in (UDP_ACK, UDP_RST) and reply[2] == msg_id:
+            return (time.monotonic() - start) * 1000, reply
+
+
+def mqtt_str(s):
+    b = s.encode()
+    return struct.pack(">H", len(b)) + b
+
+
+def mqtt_packet(ptype, body):
+    # Remaining length, variable length encoding
+    n, enc = len(body), b""
+    while True:
+        byte, n = n % 128, n // 128
+        enc += bytes([byte | (0x80 if n else 0)])
+        if not n:
+            break
+    return bytes([ptype]) + enc + body
+
+
+def mqtt_read(sock):
+    head = sock.recv(1)
+    if not head:
+        raise ConnectionError("broker closed the connection")
+    length, mult = 0, 1
+    while True:
+        b = sock.recv(1)[0]
+        length += (b & 0x7F) * mult
+        mult *= 128
+        if not b & 0x80:
+            break
+    body = b""
+    while len(body) < length:
+        body += sock.recv(length - len(body))
+    return head[0], body
+
+
+class Mqtt:
+    def __init__(self, host, port, user, password):
+        self.sock = socket.create_connection((host, port), timeout=5)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        flags = 0x02 | (0x80 if user else 0) | (0x40 if password else 0)
+        body = mqtt_str("MQTT") + bytes([4, flags]) + struct.pack(">H", 60)
+        body += mqtt_str("udp-peer-%04x" % random.getrandbits(16))
+        if user:
+            body += mqtt_str(user)
+        if password:
+            body += mqtt_str(password)
+        self.sock.sendall(mqtt_packet(0x10, body))
+        ptype, body = mqtt_read(self.sock)
+        if ptype != 0x20 or body[1] != 0:
+            raise ConnectionError("CONNACK refused, rc=%d" % body[1])
+
+    def subscribe(self, topic):
+        self.sock.sendall(mqtt_packet(0x82, struct.pack(">H", 1) + mqtt_str(topic) + b"\x00"))
+        while mqtt_read(self.sock)[0] != 0x90:
+            pass
+
+    def publish(self, topic, payload):
+        self.sock.sendall(mqtt_packet(0x30, mqtt_str(topic) + payload.encode()))
+
+    def wait_publish(self, topic, payload, timeout):
+        end = time.monotonic() + timeout
+        while time.monotonic() < end:
+            self.sock.settimeout(max(end - time.monotonic(), 0.001))
+            try:
+                ptype, body = mqtt_read(self.sock)
+            except socket.timeout:
+                return False
+            if ptype & 0xF0 == 0x30:
+                tlen = struct.unpack(">H", body[:2])[0]
+                if body[2:2 + tlen].decode() == topic and body[2 + tlen:].decode() == payload:
+                    return True
+        return False
+
+
+def report(name, rtts, sent):
+    if not rtts:
+        print("%-5s no replies out of %d" % (name, sent))
+        return
+    rtts = sorted(rtts)
+    p95 = rtts[min(len(rtts) - 1, int(len(rtts) * 0.95))]
+    print("%-5s %3d/%d replies  min %6.1f  median %6.1f  p95 %6.1f  max %6.1f ms" %
+          (name, len(rtts), sent, rtts[0], statistics.median(rtts), p95, rtts[-1]))
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Round trip test peer for the iron timer UDP channel")
+    ap.add_argument("device", help="Core2 IP address")
+    ap.add_argument("--broker", help="MQTT broker IP, leave out to test UDP only")
+    ap.add_argument("--mqtt-port", type=int, default=1883)
+    ap.add_argument("--user", default="esp32")
+    ap.add_argument("--password", default="core2")
+    ap.add_argument("--cmd-topic", default="iron_cmd", help="Command topic of the active profile")
+    ap.add_argument("--count", type=int, default=50)
+    ap.add_argument("--interval", type=float, default=0.5, help="Seconds between requests")
+    ap.add_argument("--timeout", type=float, default=2.0)
+    ap.add_argument("--extend", action="store_true", help="Send one EXTEND instead of measuring")
+    ap.add_argument("--token", default="", help="UDP_TOKEN the firmware was built with")
+    args = ap.parse_args()
+
+    udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    addr = (args.device, UDP_PORT)
+    msg_id = random.getrandbits(16)
+
+    if args.extend:
+        rtt, reply = udp_request(udp, addr, UDP_CODE_EXTEND, msg_id, args.token.encode(), args.timeout)
+        if reply is None:
+            print("No reply")
+        elif reply[0] == UDP_RST:
+            print("Refused (token), %.1f ms" % rtt)
+        else:
+            print("Extended, timer now %u s, %.1f ms" % (reply[3], rtt))
+        return
+
+    mqtt = None
+    if args.broker:
+        mqtt = Mqtt(args.broker, args.mqtt_port, args.user, args.password)
+        mqtt.subscribe(PONG_TOPIC)
+
+    udp_rtts, mqtt_rtts = [], []
+    for n in range(args.count):
+        rtt, _ = udp_request(udp, addr, UDP_CODE_PING, (msg_id + n) & 0xFFFF, b"", args.timeout)
+        if rtt is not None:
+            udp_rtts.append(rtt)
+
+        if mqtt:
+            start = time.monotonic()
+            mqtt.publish(args.cmd_topic, "ping %d" % n)
+            if mqtt.wait_publish(PONG_TOPIC, str(n), args.timeout):
+                mqtt_rtts.append((time.monotonic() - start) * 1000)
+        time.sleep(args.interval)
+
+    report("UDP", udp_rtts, args.count)
+    if mqtt:
+        report("MQTT", mqtt_rtts, args.count)
+
+
+if __name__ == "__main__":
+    main()